@@ -37,6 +37,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "date.h"
@@ -193,11 +195,32 @@ struct buf* bread ( uint dev, uint blockno )
 	if ( ( b->flags & B_VALID ) == 0 )
 	{
 		iderw( b );
+
+		if ( myproc() )
+		{
+			myproc()->acct.inblock += 1;
+		}
 	}
 
 	return b;
 }
 
+/* Return a locked buf for the indicated block without reading
+   the block from disk. Only for callers that overwrite the whole
+   block before using or writing it (see swap.c). Saves a disk
+   read per block.
+*/
+struct buf* bgetblank ( uint dev, uint blockno )
+{
+	struct buf* b;
+
+	b = bget( dev, blockno );
+
+	b->flags |= B_VALID;
+
+	return b;
+}
+
 // Write b's contents to disk. Must be locked.
 /* Writes a modified buffer to the appropriate block on the disk
 */
@@ -211,6 +234,11 @@ void bwrite ( struct buf* b )
 	b->flags |= B_DIRTY;  // tell iderw to write (rather than read)
 
 	iderw( b );
+
+	if ( myproc() )
+	{
+		myproc()->acct.oublock += 1;
+	}
 }
 
 /* Release a locked buffer:
@@ -181,6 +181,7 @@ void consoleintr ( int ( *getc ) ( void ) )
 {
 	int c;
 	int doprocdump = 0;
+	int dokmemdump = 0;
 	int dotestthing = 0;
 
 	//
@@ -219,6 +220,13 @@ void consoleintr ( int ( *getc ) ( void ) )
 
 					break;
 
+				// Free memory statistics
+				case C( 'K' ):
+
+					dokmemdump = 1;
+
+					break;
+
 				// Kill line
 				case C( 'U' ):
 
@@ -322,6 +330,14 @@ void consoleintr ( int ( *getc ) ( void ) )
 		procdump();  // now call procdump() without cons.lock held
 	}
 
+	if ( dokmemdump )
+	{
+		kmemdump();  // cprintf locks cons.lock
+		slabdump();
+		swapdump();
+		pcdump();
+	}
+
 	if ( dotestthing )
 	{
 		cprintf( "Hacker thingies!\n" );
@@ -2,19 +2,28 @@
 
 struct buf;
 struct context;
+struct fdtable;
 struct file;
 struct inode;
 struct mouseStatus;
+struct pcpage;
 struct pipe;
 struct proc;
+struct procinfo;
 struct rtcdate;
+struct rusage;
+struct slabcache;
 struct sleeplock;
 struct spinlock;
 struct stat;
 struct superblock;
+struct timer;
+struct trapframe;
+struct vmspace;
 
 // bio.c
 void            binit  ( void );
+struct buf*     bgetblank ( uint, uint );
 struct buf*     bread  ( uint, uint );
 void            brelse ( struct buf* );
 void            bwrite ( struct buf* );
@@ -31,10 +40,19 @@ void            getcallerpcs ( void*, uint*, uint );
 // display.c
 void            displayinit ( void );
 
+// e820.c
+void            e820init ( void );
+extern uint     phystop;
+
 // exec.c
 int             exec ( char*, char* [] );
 
 // file.c
+struct fdtable* fdtalloc  ( struct inode* );
+struct fdtable* fdtcopy   ( struct fdtable* );
+struct fdtable* fdtdup    ( struct fdtable* );
+int             fdtgrow   ( struct fdtable* );
+void            fdtput    ( struct fdtable* );
 struct file*    filealloc ( void );
 void            fileclose ( struct file* );
 struct file*    filedup   ( struct file* );
@@ -63,6 +81,11 @@ int             readi       ( struct inode*, char*, uint, uint );
 void            stati       ( struct inode*, struct stat* );
 int             writei      ( struct inode*, char*, uint, uint );
 
+// futex.c
+void            futexinit ( void );
+int             futexwait ( int*, int );
+int             futexwake ( int*, int );
+
 // ide.c
 void            ideinit ( void );
 void            ideintr ( void );
@@ -74,10 +97,18 @@ void            ioapicenable ( int irq, int cpu );
 void            ioapicinit   ( void );
 
 // kalloc.c
-char*           kalloc ( void );
-void            kfree  ( char* );
-void            kinit1 ( void*, void* );
-void            kinit2 ( void*, void* );
+char*           kalloc       ( void );
+char*           kalloc_order ( int );
+void            kfree        ( char* );
+void            kfree_order  ( char*, int );
+void            kinit1       ( void*, void* );
+void            kinit2       ( void*, void* );
+void            kmemdump     ( void );
+char*           kzalloc      ( void );
+int             kzrefill     ( void );
+
+// kconfig.c
+void            kconfiginit ( void );
 
 // kbd.c
 void            kbdintr ( void );
@@ -91,7 +122,9 @@ void            cmostime     ( struct rtcdate *r );
 int             lapicid      ( void );
 void            lapiceoi     ( void );
 void            lapicinit    ( void );
+void            lapicipi     ( int, int );
 void            lapicstartap ( uchar, uint );
+void            lapictimer   ( int );
 void            microdelay   ( int );
 
 // log.c
@@ -109,6 +142,14 @@ void            getMouseStatus ( struct mouseStatus* );
 extern int      ismp;
 void            mpinit ( void );
 
+// pagecache.c
+void            pcdump   ( void );
+struct pcpage*  pcget    ( uint, uint, uint );
+void            pcinit   ( void );
+void            pcinval  ( uint, uint );
+void            pcrelse  ( struct pcpage* );
+void            pcupdate ( uint, uint, uint, char*, uint );
+
 // picirq.c
 void            picenable ( int );
 void            picinit   ( void );
@@ -116,14 +157,25 @@ void            picinit   ( void );
 // pipe.c
 int             pipealloc ( struct file**, struct file** );
 void            pipeclose ( struct pipe*, int );
+void            pipeinit  ( void );
 int             piperead  ( struct pipe*, char*, int );
 int             pipewrite ( struct pipe*, char*, int );
 
+// prof.c
+void            profinit   ( void );
+void            profsample ( struct trapframe* );
+
 // proc.c
+void            accttick  ( int );
 int             cpuid     ( void );
 void            exit      ( void );
+int             clone     ( char* );
 int             fork      ( void );
+uint            getaffinity ( int );
+int             getprocs  ( struct procinfo*, int );
+int             getrusage ( int, struct rusage* );
 int             growproc  ( int );
+int             join      ( char** );
 int             kill      ( int );
 struct cpu*     mycpu     ( void );
 struct proc*    myproc    ( void );
@@ -131,13 +183,33 @@ void            procdump  ( void );
 void            procinit  ( void );
 void            scheduler ( void ) __attribute__( ( noreturn ) );
 void            sched     ( void );
+int             schedtick ( void );
+int             setaffinity ( int, uint );
+int             setpriority ( int, int );
 void            setproc   ( struct proc* );
 void            sleep     ( void*, struct spinlock* );
+int             sleeptimeout ( void*, struct spinlock*, uint );
+struct proc*    swapbegin ( int* );
+void            swapend   ( struct proc* );
 void            userinit  ( void );
+struct vmspace* vmcreate  ( pde_t*, uint );
+void            vmput     ( struct vmspace* );
 int             wait      ( void );
 void            wakeup    ( void* );
+int             wakeupn   ( void*, int );
+void            wakeupone ( void* );
 void            yield     ( void );
 
+// shm.c
+int             shmcontains ( pde_t*, uint, uint );
+int             shmdt       ( char* );
+void            shmexit     ( int );
+int             shmfork     ( pde_t*, pde_t* );
+char*           shmat       ( int );
+int             shmget      ( int, uint );
+void            shminit     ( void );
+void            shmrelease  ( pde_t* );
+
 // swtch.S
 void            swtch ( struct context**, struct context* );
 
@@ -149,6 +221,13 @@ void            popcli   ( void );
 void            pushcli  ( void );
 void            release  ( struct spinlock* );
 
+// slab.c
+void*             slaballoc  ( struct slabcache* );
+struct slabcache* slabcreate ( char*, uint, void ( * ) ( void* ) );
+void              slabdump   ( void );
+void              slabfree   ( struct slabcache*, void* );
+void              slabinit   ( void );
+
 // sleeplock.c
 void            acquiresleep  ( struct sleeplock* );
 int             holdingsleep  ( struct sleeplock* );
@@ -165,6 +244,18 @@ int             strlen     ( const char* );
 int             strncmp    ( const char*, const char*, int );
 char*           strncpy    ( char*, const char*, int );
 
+// swap.c
+int             swapalloc   ( void );
+void            swapdump    ( void );
+int             swapfault   ( struct proc*, uint );
+void            swapfree    ( int );
+void            swapinit    ( int );
+void            swapread    ( int, char* );
+int             swapreclaim ( void );
+void            swapwrite   ( int, char* );
+char*           ukalloc     ( void );
+char*           ukzalloc    ( void );
+
 // syscall.c
 int             argint   ( int, int* );
 int             argptr   ( int, char**, int );
@@ -175,6 +266,9 @@ void            syscall  ( void );
 
 // timer.c
 void            timerinit ( void );
+void            timeradd  ( struct timer*, uint, void ( * ) ( void* ), void* );
+int             timerdel  ( struct timer* );
+void            timertick ( uint );
 
 // trap.c
 extern struct spinlock tickslock;
@@ -205,12 +299,20 @@ pde_t*          copyuvm    ( pde_t*, uint );
 int             deallocuvm ( pde_t*, uint, uint );
 void            freevm     ( pde_t* );
 void            inituvm    ( pde_t*, char*, uint );
+int             isshared   ( pde_t*, uint );
 void            kvmalloc   ( void );
+void            kvmenableglobal ( void );
 int             loaduvm    ( pde_t*, char*, struct inode*, uint, uint );
+int             mapshared  ( pde_t*, uint, char**, uint );
 void            seginit    ( void );
 pde_t*          setupkvm   ( void );
 void            switchkvm  ( void );
 void            switchuvm  ( struct proc* );
+int             swapinpage ( pde_t*, uint );
+int             swapinrange ( pde_t*, uint, uint );
+int             swapoutpage ( pde_t*, uint, uint*, int );
+void            unmapshared ( pde_t*, uint, uint );
+char*           userVAddrToPhysAddr ( pde_t*, char* );
 
 // number of elements in fixed-size array
 #define NELEM( x ) ( sizeof( x ) / sizeof( ( x )[ 0 ] ) )
@@ -0,0 +1,106 @@
+// Physical memory detection
+
+/* Finds out how much physical memory there is from the BIOS memory
+   map (E820). bootasm.S asks the BIOS for the map before leaving
+   real mode, and leaves it at E820MAP:
+
+     E820MAP     : ushort, address just past the last entry
+     E820MAP + 4 : entries, 20 bytes each (at most E820MAX)
+
+   Each entry describes a range of physical addresses and what
+   it is (usable RAM, reserved by the BIOS, ACPI tables, ...).
+
+   The kernel manages the memory from the end of the kernel up to
+   'phystop' (kalloc.c) and maps all of it at KERNBASE (vm.c), so
+   it needs one contiguous range. This is the usable range that
+   the kernel was loaded into (the one containing EXTMEM), cut off
+   at PHYSMAX. Usable ranges beyond a hole are ignored. With QEMU
+   there is only one, for ex. "-m 512" gives 0x100000..0x1FFE0000.
+
+   If there is no memory map, phystop falls back to PHYSDEFAULT.
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+
+#define E820_RAM  1  // usable memory
+
+struct e820entry
+{
+	uint addr;     // start address (low, high 32 bits)
+	uint addrhi;
+	uint len;      // length in bytes (low, high 32 bits)
+	uint lenhi;
+	uint type;
+};
+
+uint phystop;  // Top of physical memory used by the kernel
+
+void e820init ( void )
+{
+	struct e820entry* e;
+	struct e820entry* first;
+	struct e820entry* last;
+	uint              mapend;
+	uint              top;
+
+	phystop = 0;
+
+	mapend = *( ( ushort* ) P2V( E820MAP ) );
+
+	first = ( struct e820entry* ) P2V( E820MAP + 4 );
+	last  = ( struct e820entry* ) P2V( mapend );
+
+	// Garbage, act as if there was no map
+	if ( mapend < E820MAP + 4 || mapend > E820MAP + 4 + E820MAX * sizeof( struct e820entry ) ||
+	     ( mapend - ( E820MAP + 4 ) ) % sizeof( struct e820entry ) != 0 )
+	{
+		last = first;
+	}
+
+	for ( e = first; e < last; e += 1 )
+	{
+		// Above 4GB, or not RAM
+		if ( e->addrhi != 0 || e->type != E820_RAM )
+		{
+			continue;
+		}
+
+		if ( e->addr > EXTMEM )
+		{
+			continue;
+		}
+
+		// Range doesn't reach past EXTMEM
+		if ( e->lenhi == 0 && e->addr + e->len <= EXTMEM )
+		{
+			continue;
+		}
+
+		// Range ends above 4GB
+		if ( e->lenhi != 0 || e->addr + e->len < e->addr )
+		{
+			top = PHYSMAX;
+		}
+		else
+		{
+			top = e->addr + e->len;
+		}
+
+		if ( top > PHYSMAX )
+		{
+			top = PHYSMAX;
+		}
+
+		phystop = PGROUNDDOWN( top );
+	}
+
+	// Note, runs before the console is set up, so no cprintf
+	if ( phystop == 0 )
+	{
+		phystop = PHYSDEFAULT;
+	}
+}
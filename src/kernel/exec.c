@@ -64,7 +64,8 @@ int exec ( char* path, char* argv [] )
 	struct inode*   ip;
 	struct proghdr  ph;
 	pde_t*          pgdir;
-	pde_t*          oldpgdir;
+	struct vmspace* vm;
+	struct vmspace* oldvm;
 	struct proc*    curproc;
 
 
@@ -333,6 +334,17 @@ int exec ( char* path, char* argv [] )
 	}
 
 
+	// Other threads may still be using the old address space (see clone),
+	// so the new image gets a vmspace of its own
+	// sz at this point, points to heap_base/stack_end ??
+	vm = vmcreate( pgdir, sz );
+
+	if ( vm == 0 )
+	{
+		goto bad;
+	}
+
+
 	// Save program name for debugging.
 	for ( last = s = path; *s; s += 1 )
 	{
@@ -349,16 +361,15 @@ int exec ( char* path, char* argv [] )
 	/* exec must wait to free the old image until it is sure it will succeed
 	   because if the old image is gone, it cannot return an error to it.
 	*/
-	oldpgdir = curproc->pgdir;
+	oldvm = curproc->vm;
 
-	curproc->pgdir   = pgdir;
-	curproc->sz      = sz;         // at this point, points to heap_base/stack_end ??
+	curproc->vm      = vm;
 	curproc->tf->eip = elf.entry;  // location of ELF's main
 	curproc->tf->esp = sp;
 
 	switchuvm( curproc );
 
-	freevm( oldpgdir );
+	vmput( oldvm );  // freed unless other threads use it
 
 	return 0;
 
@@ -0,0 +1,16 @@
+// A process's open files and current directory.
+// Shared by the threads of a process (see clone in proc.c).
+struct fdtable
+{
+	struct spinlock lock;                      // protects everything below
+	int             ref;                       // number of processes using the table
+
+	/* Open files. 'ofile' starts out as 'ofile0', and is moved to
+	   a page of its own if the process opens more (see fdtgrow).
+	*/
+	struct file**   ofile;                     // Open files
+	int             nofile;                    // size of ofile
+	struct inode*   cwd;                       // Current directory
+
+	struct file*    ofile0 [ NOPENFILE_PROC ];
+};
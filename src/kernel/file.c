@@ -4,7 +4,8 @@
    devices (ex. console), pipes...
    The file descriptor layer is responsible for creating this uniformity.
 
-   xv6 gives each process its own table of open files (proc->ofile).
+   xv6 gives each process its own table of open files (proc->files,
+   shared by threads, see the end of this file).
    Each open file is represented by a "struct file".
 
    Each call to 'open' creats a new open file ("struct file").
@@ -23,8 +24,8 @@
    A file can be open for reading, writing, or both. The readable and
    writeable fields track this (file->readable, file->writeable).
 
-   All the open files in the system are kept in a global file table, 'ftable'.
-   The file table has functions ? to:
+   The open files in the system are allocated from a slab cache, at
+   most kconfig.nfile of them (see kconfig.c). 'ftable' has functions ? to:
      . allocate a file              (filealloc)
      . create a duplicate reference (filedup)
      . release a reference          (fileclose)
@@ -39,6 +40,8 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fdtable.h"
+#include "kconfig.h"
 
 
 // ??
@@ -51,19 +54,30 @@ struct {
 	*/
 	struct spinlock lock;
 
-	struct file     file [ NOPENFILE_SYS ];
+	int             n;  // number of files allocated
 
 } ftable;
 
 
+static struct slabcache* filecache;
+static struct slabcache* fdtcache;
+
 void fileinit ( void )
 {
 	initlock( &ftable.lock, "ftable" );
+
+	filecache = slabcreate( "file", sizeof( struct file ), 0 );
+	fdtcache  = slabcreate( "fdtable", sizeof( struct fdtable ), 0 );
+
+	if ( filecache == 0 || fdtcache == 0 )
+	{
+		panic( "fileinit" );
+	}
 }
 
 // Allocate a file structure.
-/* Scans the file table for an unreferenced file and
-   returns a new reference.
+/* Returns a new reference, or 0 if there are kconfig.nfile
+   files open already (or no memory).
 */
 struct file* filealloc ( void )
 {
@@ -71,22 +85,20 @@ struct file* filealloc ( void )
 
 	acquire( &ftable.lock );
 
-	for ( f = ftable.file; f < ftable.file + NOPENFILE_SYS; f += 1 )
+	f = ftable.n < kconfig.nfile ? slaballoc( filecache ) : 0;
+
+	if ( f != 0 )
 	{
-		// Found an unreferenced file
-		if ( f->ref == 0 )
-		{
-			f->ref = 1;
+		memset( f, 0, sizeof( struct file ) );
 
-			release( &ftable.lock );
+		f->ref = 1;
 
-			return f;
-		}
+		ftable.n += 1;
 	}
 
 	release( &ftable.lock );
 
-	return 0;
+	return f;
 }
 
 // Increment ref count of file f.
@@ -133,8 +145,9 @@ void fileclose ( struct file* f )
 	// Close the file
 	ff = *f;
 
-	f->ref  = 0;
-	f->type = FD_NONE;
+	ftable.n -= 1;
+
+	slabfree( filecache, f );
 
 	release( &ftable.lock );
 
@@ -306,3 +319,166 @@ int filewrite ( struct file* f, char* addr, int n )
 
 	panic( "filewrite" );
 }
+
+
+// _________________________________________________________________________________
+
+/* File descriptor tables (struct fdtable).
+   fork gives the child a copy of the parent's table, clone shares
+   the parent's table with the new thread. The files are closed when
+   the last process using the table exits.
+*/
+
+// Allocate an empty table with cwd as the current directory.
+// Returns 0 if out of memory.
+struct fdtable* fdtalloc ( struct inode* cwd )
+{
+	struct fdtable* t;
+
+	t = slaballoc( fdtcache );
+
+	if ( t == 0 )
+	{
+		return 0;
+	}
+
+	initlock( &t->lock, "fdtable" );
+
+	memset( t->ofile0, 0, sizeof( t->ofile0 ) );
+
+	t->ofile  = t->ofile0;
+	t->nofile = kconfig.nofile < NOPENFILE_PROC ? kconfig.nofile : NOPENFILE_PROC;
+	t->ref    = 1;
+	t->cwd    = cwd;
+
+	return t;
+}
+
+/* Make room for kconfig.nofile open files in 't', by moving its
+   files to a page. Caller must hold t->lock.
+   Returns -1 if already at the limit (or out of memory).
+*/
+int fdtgrow ( struct fdtable* t )
+{
+	struct file** ofile;
+
+	if ( t->nofile >= kconfig.nofile || t->ofile != t->ofile0 )
+	{
+		return - 1;
+	}
+
+	// A page holds NOFILEMAX pointers, the most kconfig.nofile allows
+	ofile = ( struct file** ) kzalloc();
+
+	if ( ofile == 0 )
+	{
+		return - 1;
+	}
+
+	memmove( ofile, t->ofile0, sizeof( t->ofile0 ) );
+
+	t->ofile  = ofile;
+	t->nofile = kconfig.nofile;
+
+	return 0;
+}
+
+// Allocate a copy of 't', the files in it are shared (filedup).
+// Returns 0 if out of memory.
+struct fdtable* fdtcopy ( struct fdtable* t )
+{
+	struct fdtable* nt;
+	int             fd;
+
+	nt = fdtalloc( 0 );
+
+	if ( nt == 0 )
+	{
+		return 0;
+	}
+
+	acquire( &t->lock );
+
+	if ( t->nofile > nt->nofile && fdtgrow( nt ) < 0 )
+	{
+		release( &t->lock );
+
+		fdtput( nt );
+
+		return 0;
+	}
+
+	for ( fd = 0; fd < t->nofile; fd += 1 )
+	{
+		if ( t->ofile[ fd ] )
+		{
+			nt->ofile[ fd ] = filedup( t->ofile[ fd ] );
+		}
+	}
+
+	nt->cwd = idup( t->cwd );
+
+	release( &t->lock );
+
+	return nt;
+}
+
+// Another process uses 't'
+struct fdtable* fdtdup ( struct fdtable* t )
+{
+	acquire( &t->lock );
+
+	t->ref += 1;
+
+	release( &t->lock );
+
+	return t;
+}
+
+// A process is done with 't'. The last one closes the files.
+void fdtput ( struct fdtable* t )
+{
+	int fd;
+	int ref;
+
+	acquire( &t->lock );
+
+	t->ref -= 1;
+
+	ref = t->ref;
+
+	release( &t->lock );
+
+	if ( ref > 0 )
+	{
+		return;
+	}
+
+	for ( fd = 0; fd < t->nofile; fd += 1 )
+	{
+		if ( t->ofile[ fd ] )
+		{
+			fileclose( t->ofile[ fd ] );
+
+			t->ofile[ fd ] = 0;
+		}
+	}
+
+	if ( t->ofile != t->ofile0 )
+	{
+		kfree( ( char* ) t->ofile );
+	}
+
+	if ( t->cwd )
+	{
+		begin_op();
+
+		iput( t->cwd );
+
+		end_op();
+
+		t->cwd = 0;
+	}
+
+	slabfree( fdtcache, t );
+}
@@ -26,6 +26,10 @@ struct inode
 	int              ref;    // Reference count - number of C pointers referring to
 	                         // this in-memory copy
 
+	struct inode*    hnext;    // Next in icache hash chain (see iget)
+	struct inode*    lrunext;  // Next unreferenced inode, least recently used first
+	struct inode*    lruprev;
+
 	/* This lock is used for ... ??
 	*/
 	struct sleeplock lock;   // protects everything below here ??
@@ -61,6 +65,7 @@ extern struct devsw devsw [];
 // 1 - ROOTDEV
 #define CONSOLE 2
 #define DISPLAY 3
+#define PROF    4  // sampling profiler (see prof.c)
 // DEVNULL  // (minor0: null, minor1: zero)
 // MOUSE
 // KEYBOARD
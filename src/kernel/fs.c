@@ -68,6 +68,9 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "fdtable.h"
+#include "pagecache.h"
+#include "kconfig.h"
 
 
 // There should be one superblock per disk device, but we run with
@@ -218,7 +221,7 @@ static void bfree ( int dev, uint blocknum )
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   can be recycled if ip->ref is zero. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
@@ -323,16 +326,20 @@ static void bfree ( int dev, uint blocknum )
    Diagram of the inode block:
        | dinode(0)..dinode(IPB - 1) | dinode(IPB)..dinode(2*IPB - 1) | ... | dinode(...)..dinode(NINODE) |
 
-   Diagram of the inode cache:
-       | spinlock | inode(0) | inode(1) | ... | inode(NINODE) |
+   The inode cache (see below) is a hash table of inodes allocated
+   from a slab cache, at most kconfig.ninode of them.
 */
 
+#define NIHASH  64
+#define IHASH( dev, inum ) ( &icache.hash[ ( ( dev ) * 31 + ( inum ) ) % NIHASH ] )
+
 // Inode cache
 /* Holds in-memory copies of on-disk inodes.
 
-   An inode is kept in the cache if its reference count is
-   greater than zero. Otherwise, the cache entry is re-used
-   for a different inode.
+   An inode is kept in the cache while its reference count is
+   greater than zero. After that it stays cached on the 'lru' list
+   until the cache is full, then the least recently used one is
+   re-used for a different inode. Lookups hash on (dev, inum).
 
    It's real job is synchronizing access by multiple processes;
    caching is secondary...
@@ -347,23 +354,61 @@ struct {
 	*/
 	struct spinlock lock;
 
-	struct inode    inode [ NINODE ];
+	struct inode*   hash [ NIHASH ];
+
+	struct inode*   lruhead;  // unreferenced inodes, least recently used first
+	struct inode*   lrutail;
+
+	int             n;        // number of inodes allocated
 
 } icache;
 
+static struct slabcache* inodecache;
+
+
+// Take ip off the lru list. Caller must hold icache.lock
+static void lruremove ( struct inode* ip )
+{
+	if ( ip->lruprev )
+	{
+		ip->lruprev->lrunext = ip->lrunext;
+	}
+	else
+	{
+		icache.lruhead = ip->lrunext;
+	}
+
+	if ( ip->lrunext )
+	{
+		ip->lrunext->lruprev = ip->lruprev;
+	}
+	else
+	{
+		icache.lrutail = ip->lruprev;
+	}
+
+	ip->lrunext = 0;
+	ip->lruprev = 0;
+}
+
 
 static struct inode* iget ( uint dev, uint inum );
 
 
-void iinit ( int dev )
+static void inodector ( void* p )
 {
-	int i = 0;
+	initsleeplock( &( ( struct inode* ) p )->lock, "inode" );
+}
 
+void iinit ( int dev )
+{
 	initlock( &icache.lock, "icache" );
 
-	for ( i = 0; i < NINODE; i += 1 )
+	inodecache = slabcreate( "inode", sizeof( struct inode ), inodector );
+
+	if ( inodecache == 0 )
 	{
-		initsleeplock( &icache.inode[ i ].lock, "inode" );  // can concat idx to make name unique
+		panic( "iinit" );
 	}
 
 	readsb( dev, &sb );
@@ -376,7 +421,9 @@ void iinit ( int dev )
 	cprintf( "    ndatablocks         %d\n",   sb.ndatablocks                        );
 	cprintf( "    logstart            %d\n",   sb.logstart                           );
 	cprintf( "    inodestart          %d\n",   sb.inodestart                         );
-	cprintf( "    bmapstart           %d\n\n", sb.bmapstart                          );
+	cprintf( "    bmapstart           %d\n",   sb.bmapstart                          );
+	cprintf( "    swapstart           %d\n",   sb.swapstart                          );
+	cprintf( "    nswapblocks         %d\n\n", sb.nswapblocks                        );
 }
 
 
@@ -483,54 +530,69 @@ struct inode* idup ( struct inode* ip )
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 //
-/* Looks through the inode cache for an active entry (ip->ref > 0)
-   with the desired device and inode number.
+/* Looks up the inode cache hash for an entry with the desired
+   device and inode number.
    If it finds one, it returns a new reference to that inode ??
 
-   As iget scans, it records the position of the first empty
-   slot, which it uses if it needs to allocate a cache entry.
+   Otherwise it allocates a new entry, or once there are
+   kconfig.ninode of them, recycles the least recently used
+   unreferenced one.
 */
 static struct inode* iget ( uint dev, uint inum )
 {
-	struct inode* ip;
-	struct inode* empty;
+	struct inode** pp;
+	struct inode*  ip;
 
 	acquire( &icache.lock );
 
-	empty = 0;
-
 	// Is the inode already cached
-	for ( ip = &icache.inode[ 0 ]; ip < &icache.inode[ NINODE ]; ip += 1 )
+	for ( ip = *IHASH( dev, inum ); ip; ip = ip->hnext )
 	{
-		if ( ( ip->ref > 0 ) && ( ip->dev == dev ) && ( ip->inum == inum ) )
+		if ( ( ip->dev == dev ) && ( ip->inum == inum ) )
 		{
+			if ( ip->ref == 0 )
+			{
+				lruremove( ip );
+			}
+
 			ip->ref += 1;
 
 			release( &icache.lock );
 
 			return ip;
 		}
+	}
+
+	if ( icache.n < kconfig.ninode && ( ip = slaballoc( inodecache ) ) != 0 )
+	{
+		icache.n += 1;
+	}
+	else if ( ( ip = icache.lruhead ) != 0 )
+	{
+		// Recycle an inode cache entry
+		lruremove( ip );
 
-		// Remember empty slot
-		if ( empty == 0 && ip->ref == 0 )
+		for ( pp = IHASH( ip->dev, ip->inum ); *pp != ip; pp = &( *pp )->hnext )
 		{
-			empty = ip;
+			//
 		}
-	}
 
-	// Recycle an inode cache entry
-	if ( empty == 0 )
+		*pp = ip->hnext;
+	}
+	else
 	{
 		panic( "iget: no inodes" );
 	}
 
-	ip = empty;
-
 	ip->dev   = dev;
 	ip->inum  = inum;
 	ip->ref   = 1;
 	ip->valid = 0;
 
+	ip->hnext = *IHASH( dev, inum );
+
+	*IHASH( dev, inum ) = ip;
+
 	release( &icache.lock );
 
 	return ip;
@@ -625,6 +687,24 @@ void iput ( struct inode* ip )
 	// Decrement the reference count
 	ip->ref -= 1;
 
+	// Keep it cached, it's the first to go when room is needed
+	if ( ip->ref == 0 )
+	{
+		ip->lrunext = 0;
+		ip->lruprev = icache.lrutail;
+
+		if ( icache.lrutail )
+		{
+			icache.lrutail->lrunext = ip;
+		}
+		else
+		{
+			icache.lruhead = ip;
+		}
+
+		icache.lrutail = ip;
+	}
+
 	release( &icache.lock );
 
 
@@ -930,11 +1010,81 @@ void itrunc ( struct inode* ip )  // JK - make public so can use for O_TRUNC...
 	ip->size = 0;  // reset inode size
 
 	iupdate( ip );  // write changes to disk
+
+	pcinval( ip->dev, ip->inum );  // drop cached file data
 }
 
 
 // _________________________________________________________________________________
 
+/* Read n bytes of a regular file to dst through the page cache
+   (see pagecache.c). Pages that aren't cached are filled from the
+   file's data blocks, with zeros past EOF.
+
+   Returns the number of bytes read. This is less than n if the
+   page cache has no free pages, readi reads the rest directly.
+   Caller must hold ip->lock, and have checked off and n against
+   the file's size.
+*/
+static uint readpages ( struct inode* ip, char* dst, uint off, uint n )
+{
+	struct pcpage* pg;
+	struct buf*    buffer;
+	uint           nRead,
+	               nReadTotal,
+	               blockno,
+	               i;
+
+	nReadTotal = 0;
+
+	while ( nReadTotal < n )
+	{
+		pg = pcget( ip->dev, ip->inum, off / PGSIZE );
+
+		if ( pg == 0 )
+		{
+			break;
+		}
+
+		// Not cached, read in the page's data blocks
+		if ( ! pg->valid )
+		{
+			for ( i = 0; i < PGSIZE / BLOCKSIZE; i += 1 )
+			{
+				blockno = ( off / PGSIZE ) * ( PGSIZE / BLOCKSIZE ) + i;
+
+				// Past EOF, no data block
+				if ( blockno * BLOCKSIZE >= ip->size )
+				{
+					memset( pg->data + i * BLOCKSIZE, 0, BLOCKSIZE );
+
+					continue;
+				}
+
+				buffer = bread( ip->dev, bmap( ip, blockno ) );
+
+				memmove( pg->data + i * BLOCKSIZE, buffer->data, BLOCKSIZE );
+
+				brelse( buffer );
+			}
+
+			pg->valid = 1;
+		}
+
+		nRead = MIN( PGSIZE - ( off % PGSIZE ), n - nReadTotal );
+
+		memmove( dst, pg->data + ( off % PGSIZE ), nRead );
+
+		pcrelse( pg );
+
+		nReadTotal += nRead;
+		off        += nRead;
+		dst        += nRead;
+	}
+
+	return nReadTotal;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 /* Read n bytes of the inode's data blocks to dst.
@@ -974,10 +1124,19 @@ int readi ( struct inode* ip, char* dst, uint off, uint n )
 		n = ip->size - off;  // Read only the bytes from offset to EOF
 	}
 
-	// Copy data from inode data blocks to dst
 	nRead      = 0;
 	nReadTotal = 0;
 
+	// Regular files are read through the page cache
+	if ( ip->type == T_FILE )
+	{
+		nReadTotal = readpages( ip, dst, off, n );
+
+		off += nReadTotal;
+		dst += nReadTotal;
+	}
+
+	// Copy (remaining) data from inode data blocks to dst
 	while ( nReadTotal < n )
 	{
 		// Read in data block containing the offset
@@ -1071,6 +1230,12 @@ int writei ( struct inode* ip, char* src, uint off, uint n )
 
 		log_write( buffer );  // write data block changes to disk
 
+		// Keep cached copy (if any) up to date
+		if ( ip->type == T_FILE )
+		{
+			pcupdate( ip->dev, ip->inum, off, src, nWritten );
+		}
+
 		brelse( buffer );
 
 		nWrittenTotal += nWritten;
@@ -1357,7 +1522,11 @@ static struct inode* namex ( char* path, int nameiparent, char* name )
 	}
 	else
 	{
-		ip = idup( myproc()->cwd );  // current working directory
+		acquire( &myproc()->files->lock );  // chdir in another thread
+
+		ip = idup( myproc()->files->cwd );  // current working directory
+
+		release( &myproc()->files->lock );
 	}
 
 	// For each element in the path
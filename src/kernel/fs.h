@@ -5,7 +5,9 @@
 #define BLOCKSIZE  512  // block size
 
 // Disk layout:
-// [ boot block | super block | log | inode blocks | free bit map | data blocks]
+// [ boot block | super block | log | inode blocks | free bit map | data blocks | swap area ]
+//
+// The swap area is not part of the file system (see swap.c).
 //
 // mkfs computes the super block and builds an initial file system.
 // The super block describes the disk layout:
@@ -18,6 +20,8 @@ struct superblock
 	uint logstart;     // Block number of first log block
 	uint inodestart;   // Block number of first inode block
 	uint bmapstart;    // Block number of first free map block
+	uint swapstart;    // Block number of first swap block
+	uint nswapblocks;  // Number of swap blocks
 };
 
 /* TODO: A downside of having a large NDIRECT value is that most files
@@ -0,0 +1,146 @@
+// Futexes ("fast user-space mutexes")
+
+/* Lets user programs block on a lock (or any other word in memory)
+   without spinning or polling with sleep( ticks ).
+
+   The lock itself lives in user memory, and user code takes and
+   releases it with atomic instructions (see ulock.c). The kernel
+   is only asked for help when a thread has to wait:
+     . futexwait( addr, val ) sleeps until woken up, but only if
+       *addr still holds 'val'. The check and the sleep are atomic
+       with respect to futexwake, so a wakeup that comes after the
+       value changed can't be missed
+     . futexwake( addr, n ) wakes up at most n threads waiting
+       on addr
+
+   A futex is identified by the physical address of the word, not
+   its virtual address, so that processes that have the same page
+   mapped at different addresses (shared memory) or the same page
+   table (threads, see clone) all agree on it. The kernel virtual
+   address of the word is used directly as the sleep channel.
+
+   The page can't move while somebody waits on it: the waiter is in
+   a system call, so the swap clock hand leaves its memory alone, and
+   shared memory and the memory of threads are never swapped out.
+
+   A lock per bucket (hashed by channel) makes the value check and
+   going to sleep atomic. Waiters on unrelated futexes rarely
+   contend, and sleep/wakeup keep their own (hashed) queues.
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+
+#define NFUTEXBUCKET  16
+#define FUTEXBUCKET( chan ) ( &futexbuckets[ ( ( uint ) ( chan ) >> 2 ) % NFUTEXBUCKET ] )
+
+
+static struct spinlock futexbuckets [ NFUTEXBUCKET ];
+
+
+void futexinit ( void )
+{
+	int i;
+
+	for ( i = 0; i < NFUTEXBUCKET; i += 1 )
+	{
+		initlock( &futexbuckets[ i ], "futex" );
+	}
+}
+
+
+// _________________________________________________________________________________
+
+/* Sleep channel of the futex at user address 'addr'.
+   Caller must have checked the address (see argptr).
+   Returns 0 if 'addr' is not mapped.
+*/
+static void* futexchan ( int* addr )
+{
+	char* page;
+
+	if ( ( uint ) addr % sizeof( int ) != 0 )
+	{
+		return 0;
+	}
+
+	page = userVAddrToPhysAddr( myproc()->vm->pgdir, ( char* ) addr );
+
+	if ( page == 0 )
+	{
+		return 0;
+	}
+
+	return page + ( ( uint ) addr % PGSIZE );
+}
+
+/* Sleep on the futex at 'addr' if it holds 'val'.
+   Returns -1 straight away if it doesn't (or 'addr' is bad),
+   0 after being woken up. Like sleep, the caller should recheck
+   its condition either way.
+*/
+int futexwait ( int* addr, int val )
+{
+	struct spinlock* lk;
+	int*             word;
+
+	word = futexchan( addr );
+
+	if ( word == 0 )
+	{
+		return - 1;
+	}
+
+	lk = FUTEXBUCKET( word );
+
+	acquire( lk );
+
+	if ( *word != val || myproc()->killed )
+	{
+		release( lk );
+
+		return - 1;
+	}
+
+	sleep( word, lk );
+
+	release( lk );
+
+	return 0;
+}
+
+/* Wake up at most 'n' processes waiting on the futex at 'addr'.
+   Returns the number woken up, or -1 if 'addr' is bad.
+*/
+int futexwake ( int* addr, int n )
+{
+	struct spinlock* lk;
+	int*             word;
+	int              nwoken;
+
+	word = futexchan( addr );
+
+	if ( word == 0 )
+	{
+		return - 1;
+	}
+
+	lk = FUTEXBUCKET( word );
+
+	/* Taking the lock orders us after any futexwait that already
+	   checked the value, so it is on the sleep queue by now.
+	*/
+	acquire( lk );
+
+	nwoken = wakeupn( word, n );
+
+	release( lk );
+
+	return nwoken;
+}
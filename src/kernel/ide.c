@@ -97,7 +97,7 @@ static void idestart ( struct buf* b )
 		panic( "idestart" );
 	}
 
-	if ( b->blockno >= FSSIZE )
+	if ( b->blockno >= FSSIZE + SWAPSIZE )
 	{
 		panic( "idestart: blockno too big" );
 	}
@@ -5,14 +5,73 @@ Physical memory allocator, intended to allocate memory for:
 	. page table pages
 	. pipe buffers
 
-Allocates 4096-byte pages.
+Allocates 4096-byte pages, or physically contiguous blocks
+of 2^order pages.
 
 Uses the physical memory between the end-of-the-kernel
-and PHYSTOP for allocation.
+and phystop (see e820.c) for allocation.
 */
 
 /*
-Linked list of free pages.
+Buddy allocator.
+
+Free memory is kept as blocks of 2^order pages, where a block
+of order 'n' always starts at a physical address that is a
+multiple of ( PGSIZE << n ). Each order has its own freelist.
+
+Every block of order 'n' has exactly one "buddy", the other
+half of the order 'n + 1' block it was split from. The buddy's
+page frame number only differs in bit 'n':
+	buddy_pfn = pfn ^ ( 1 << n )
+
+. Allocating an order 'n' block takes the first block from the
+  smallest non-empty freelist of order >= n, and splits it in
+  half until it is the right size. The unused halves go on the
+  freelists of their orders.
+
+. Freeing an order 'n' block checks whether its buddy is free
+  (and whole). If so, the two are merged into an order 'n + 1'
+  block and the check repeats one order up.
+
+'freeorder' records, for each physical page, whether the page
+is the first page of a free block, and the order of that block.
+That is all the information needed to find and merge buddies.
+*/
+
+/*
+Per-CPU caches.
+
+Each CPU keeps a small cache of free (order 0) pages in front
+of the buddy freelists. kalloc and kfree normally only touch the
+current CPU's cache (with interrupts disabled) and only take
+kmem.lock to move a batch of KCACHE_BATCH pages between the
+cache and the buddy freelists. This way CPUs that fork/exec/sbrk
+at the same time don't all serialize on kmem.lock.
+
+The catch is that up to KCACHE_MAX pages per CPU can sit in
+a cache while the global lists are empty. kalloc will then fail
+even though a different CPU has pages cached. This is bounded
+(KCACHE_MAX * NCPU pages), so we live with it.
+
+Cached pages look allocated to the buddy allocator, so they also
+keep their buddies from merging until they are drained.
+*/
+
+/*
+Zeroed pages.
+
+Most allocations (user memory, page tables) have to be zeroed
+before use, and zeroing a page costs about as much as copying one.
+Doing it in allocuvm, walkpgdir, etc. puts it on the critical path
+of fork, exec and sbrk.
+
+Instead, CPUs with nothing to run zero pages ahead of time
+(kzrefill, called from the scheduler's idle loop) and keep them
+in a pool. kzalloc takes a page from the pool when it can, and
+only zeroes one itself when the pool is empty.
+
+Pages in the pool are not lost to the rest of the kernel. If kalloc
+runs out of memory, it takes pages from the pool too.
 */
 
 #include "types.h"
@@ -27,21 +86,68 @@ extern char* end;  /* first address after kernel text and static data.
                       Label is created by "kernel.ld" when creating the
                       kernel ELF */
 
+#define NPAGES  ( PHYSMAX / PGSIZE )  // max number of physical pages
+
+#define PFN( vAddr ) ( V2P( vAddr ) / PGSIZE )  // page frame number
+
+/* The "struct node" of a free block is stored in the first bytes
+   of the block itself.
+   Buddy freelists are circular and doubly linked, so that a buddy
+   can be unlinked from the middle of its list when merging.
+   The per-CPU caches only use 'next'.
+*/
 struct node
 {
 	struct node* next;
+	struct node* prev;
 };
 
 struct _kmem
 {
-	struct spinlock lock;      // Held when modifying freelist
+	struct spinlock lock;      // Held when modifying the freelists
 	int             use_lock;
 
-	struct node* freelist;  // Where is this initialized ?? Is it default 0?
+	struct node freelist [ KMAXORDER + 1 ];  // One list per order. List heads, not blocks
+	uint        nfree    [ KMAXORDER + 1 ];  // Number of free blocks in each list
 };
 
 static struct _kmem kmem;
 
+static uchar freeorder [ NPAGES ];  // ( order + 1 ) if page starts a free block, else 0
+
+
+#define KCACHE_BATCH  16                  // pages moved to/from the global lists at once
+#define KCACHE_MAX    ( 2 * KCACHE_BATCH )  // drain when a cache holds more than this
+
+// Per-CPU cache of free pages.
+// Only accessed by its CPU, with interrupts disabled.
+struct _kcache
+{
+	struct node* freelist;
+	int          nfree;
+};
+
+static struct _kcache kcache [ NCPU ];
+
+
+#define KZPOOL_MAX  64  // max number of pages kept in the zeroed pool
+
+// Pool of zeroed pages.
+// Only a page's 'struct node' bytes are not zero while in the pool.
+struct _kzpool
+{
+	struct spinlock lock;
+	struct node*    freelist;
+	int             nfree;
+
+	uint            nhit;   // statistics...
+	uint            nmiss;
+};
+
+static struct _kzpool kzpool;
+
+static char* kzpooltake ( void );
+
 
 void freerange ( void* vstart, void* vend );
 
@@ -62,15 +168,25 @@ void freerange ( void* vstart, void* vend );
       {
 	     initlock( &kmem.lock, "kmem" );
 
-	     freerange( end, P2V( PHYSTOP ) );
+	     freerange( end, P2V( phystop ) );
       }
 */
 void kinit1 ( void* vstart, void* vend )
 {
+	int order;
+
 	initlock( &kmem.lock, "kmem" );
+	initlock( &kzpool.lock, "kzpool" );
 
 	kmem.use_lock = 0;
 
+	// Empty lists point to themselves
+	for ( order = 0; order <= KMAXORDER; order += 1 )
+	{
+		kmem.freelist[ order ].next = &kmem.freelist[ order ];
+		kmem.freelist[ order ].prev = &kmem.freelist[ order ];
+	}
+
 	freerange( vstart, vend );
 }
 
@@ -81,61 +197,302 @@ void kinit2 ( void* vstart, void* vend )
 	kmem.use_lock = 1;
 }
 
-// Add memory to freelist via per-page calls to kfree
+/* Add memory to the freelists.
+   Frees the largest aligned blocks that fit, rather than page
+   by page, so that no merging is needed.
+   (Blocks still merge with neighbours freed by an earlier call,
+   ex. across the 4MB boundary between kinit1 and kinit2).
+*/
 void freerange ( void* vstart, void* vend )
 {
 	char* p;
+	int   order;
 
 	p = ( char* ) PGROUNDUP( ( uint ) vstart );  // page align
 
 	while ( p + PGSIZE <= ( char* ) vend )
 	{
-		kfree( p );
+		order = KMAXORDER;
+
+		while ( order > 0 &&
+		        ( V2P( p ) % ( PGSIZE << order ) != 0 ||
+		          p + ( PGSIZE << order ) > ( char* ) vend ) )
+		{
+			order -= 1;
+		}
+
+		kfree_order( p, order );
+
+		p += PGSIZE << order;
+	}
+}
+
+
+// _________________________________________________________________________________
+
+static void listpush ( struct node* head, struct node* np )
+{
+	np->next         = head->next;
+	np->prev         = head;
+	head->next->prev = np;
+	head->next       = np;
+}
+
+static void listremove ( struct node* np )
+{
+	np->prev->next = np->next;
+	np->next->prev = np->prev;
+}
+
+/* Return a block of 2^order pages to the freelists,
+   merging it with its buddy for as long as possible.
+   Caller must hold kmem.lock (once initialized).
+*/
+static void buddyfree ( char* vAddr, int order )
+{
+	uint         pfn;
+	uint         buddypfn;
+	struct node* np;
+
+	pfn = PFN( vAddr );
+
+	if ( freeorder[ pfn ] != 0 )
+	{
+		panic( "kfree: double free" );
+	}
+
+	while ( order < KMAXORDER )
+	{
+		buddypfn = pfn ^ ( 1 << order );
+
+		// Buddy is not free, or is split into smaller free blocks
+		if ( buddypfn >= NPAGES || freeorder[ buddypfn ] != order + 1 )
+		{
+			break;
+		}
+
+		// Take buddy off its list and merge
+		listremove( ( struct node* ) P2V( buddypfn * PGSIZE ) );
+
+		freeorder[ buddypfn ] = 0;
+
+		kmem.nfree[ order ] -= 1;
+
+		pfn   &= ~ ( 1 << order );  // merged block starts at the lower of the two
+		order += 1;
+	}
+
+	np = ( struct node* ) P2V( pfn * PGSIZE );
+
+	listpush( &kmem.freelist[ order ], np );
+
+	freeorder[ pfn ] = order + 1;
+
+	kmem.nfree[ order ] += 1;
+}
+
+/* Remove a block of 2^order pages from the freelists,
+   splitting a larger block if needed.
+   Returns 0 if there is no free block large enough.
+   Caller must hold kmem.lock (once initialized).
+*/
+static char* buddyalloc ( int order )
+{
+	struct node* np;
+	char*        half;
+	int          o;
+
+	// Find smallest non-empty list that fits
+	for ( o = order; o <= KMAXORDER; o += 1 )
+	{
+		if ( kmem.freelist[ o ].next != &kmem.freelist[ o ] )
+		{
+			break;
+		}
+	}
 
-		p += PGSIZE;
+	if ( o > KMAXORDER )
+	{
+		return 0;
 	}
+
+	np = kmem.freelist[ o ].next;
+
+	listremove( np );
+
+	freeorder[ PFN( np ) ] = 0;
+
+	kmem.nfree[ o ] -= 1;
+
+	// Split, freeing the upper half each time
+	while ( o > order )
+	{
+		o -= 1;
+
+		half = ( char* ) np + ( PGSIZE << o );
+
+		listpush( &kmem.freelist[ o ], ( struct node* ) half );
+
+		freeorder[ PFN( half ) ] = o + 1;
+
+		kmem.nfree[ o ] += 1;
+	}
+
+	return ( char* ) np;
 }
 
+
+// _________________________________________________________________________________
+
+// Move KCACHE_BATCH pages from the cache to the buddy freelists.
+// Caller must have interrupts disabled.
+static void kcachedrain ( struct _kcache* c )
+{
+	struct node* np;
+	int          n;
+
+	acquire( &kmem.lock );
+
+	for ( n = 0; n < KCACHE_BATCH && c->freelist; n += 1 )
+	{
+		np          = c->freelist;
+		c->freelist = np->next;
+		c->nfree   -= 1;
+
+		buddyfree( ( char* ) np, 0 );
+	}
+
+	release( &kmem.lock );
+}
+
+// Move up to KCACHE_BATCH pages from the buddy freelists to the cache.
+// Caller must have interrupts disabled.
+static void kcacherefill ( struct _kcache* c )
+{
+	struct node* np;
+	int          n;
+
+	acquire( &kmem.lock );
+
+	for ( n = 0; n < KCACHE_BATCH; n += 1 )
+	{
+		np = ( struct node* ) buddyalloc( 0 );
+
+		if ( np == 0 )
+		{
+			break;
+		}
+
+		np->next    = c->freelist;
+		c->freelist = np;
+		c->nfree   += 1;
+	}
+
+	release( &kmem.lock );
+}
+
+
+// _________________________________________________________________________________
+
 // Free the page of physical memory pointed at by vAddr,
 // which normally should have been returned by a
 // call to kalloc(). (The exception is when
 // initializing the allocator; see kinit above.)
 void kfree ( char* vAddr )
 {
-	struct node* np;
+	struct node*    np;
+	struct _kcache* c;
 
 	// Not page aligned or outside valid range
 	if ( ( uint ) vAddr % PGSIZE   ||
 		 vAddr < end               ||  // kernel.end
-		 V2P( vAddr ) >= PHYSTOP )
+		 V2P( vAddr ) >= phystop )
 	{
 		panic( "kfree" );
 	}
 
 
-	// Fill with junk to hopefully catch dangling refs.
-	memset( vAddr, 1, PGSIZE );
+	#if KALLOC_DEBUG
+		// Fill with junk to hopefully catch dangling refs.
+		memset( vAddr, 1, PGSIZE );
+	#endif
 
 
-	if ( kmem.use_lock )
+	// Still initializing (single CPU), free directly to the buddy lists
+	if ( ! kmem.use_lock )
 	{
-		acquire( &kmem.lock );
+		buddyfree( vAddr, 0 );
+
+		return;
 	}
 
 
-	// Add the page to the start of the freelist
-	np = ( struct node* ) vAddr;  // The page's "struct node" (pointer to the next free
-	                              // page) is stored in the first bytes of the page
+	pushcli();  // stay on this CPU while using its cache
 
-	np->next = kmem.freelist;  // record old start of the list in np->next
+	c = &kcache[ cpuid() ];
 
-	kmem.freelist = np;        // set new start of list as np
+	// Add the page to the start of the cache's freelist
+	np = ( struct node* ) vAddr;
 
+	np->next    = c->freelist;  // record old start of the list in np->next
+	c->freelist = np;           // set new start of list as np
+	c->nfree   += 1;
 
-	if ( kmem.use_lock )
+	if ( c->nfree > KCACHE_MAX )
 	{
-		release( &kmem.lock );
+		kcachedrain( c );
+	}
+
+	popcli();
+}
+
+// Allocate one page from the per-CPU cache (or buddy lists).
+static char* kallocpage ( void )
+{
+	struct node*    np;
+	struct _kcache* c;
+
+	// Still initializing (single CPU), take directly from the buddy lists
+	if ( ! kmem.use_lock )
+	{
+		np = ( struct node* ) buddyalloc( 0 );
+	}
+	else
+	{
+		pushcli();  // stay on this CPU while using its cache
+
+		c = &kcache[ cpuid() ];
+
+		if ( c->freelist == 0 )
+		{
+			kcacherefill( c );
+		}
+
+		// Remove and return first free element of list
+		np = c->freelist;
+
+		/* If not at end of freelist, update the list's head
+		   to point to next free page
+		*/
+		if ( np )
+		{
+			c->freelist = np->next;
+			c->nfree   -= 1;
+		}
+
+		popcli();
 	}
+
+
+	// Fill with junk...
+	#if KALLOC_DEBUG
+		if ( np )
+		{
+			memset( ( char* ) np, 5, PGSIZE );
+		}
+	#endif
+
+	return ( char* ) np;  // np can be null...
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -143,34 +500,250 @@ void kfree ( char* vAddr )
 // Returns 0 if the memory cannot be allocated.
 char* kalloc ( void )
 {
-	struct node* np;
+	char* p;
+
+	p = kallocpage();
+
+	// Out of memory, use a page from the zeroed pool
+	if ( p == 0 && kmem.use_lock )
+	{
+		p = kzpooltake();
+	}
+
+	return p;
+}
+
+/* Free a block of 2^order physically contiguous pages,
+   which should have been returned by kalloc_order( order ).
+*/
+void kfree_order ( char* vAddr, int order )
+{
+	if ( order == 0 )
+	{
+		kfree( vAddr );
+
+		return;
+	}
+
+	// Not aligned to block size or outside valid range
+	if ( order < 0 || order > KMAXORDER                ||
+	     V2P( vAddr ) % ( PGSIZE << order )            ||
+	     vAddr < end                                   ||
+	     V2P( vAddr ) + ( PGSIZE << order ) > phystop )
+	{
+		panic( "kfree_order" );
+	}
+
+
+	#if KALLOC_DEBUG
+		memset( vAddr, 1, PGSIZE << order );
+	#endif
+
 
 	if ( kmem.use_lock )
 	{
 		acquire( &kmem.lock );
 	}
 
+	buddyfree( vAddr, order );
 
-	// Remove and return first free element of list
-	np = kmem.freelist;
+	if ( kmem.use_lock )
+	{
+		release( &kmem.lock );
+	}
+}
 
-	/* If not at end of freelist, update the list's head
-	   to point to next free page
-	*/
-	if ( np )
+/* Allocate a block of 2^order physically contiguous pages.
+   The block is aligned to its size.
+   Returns 0 if the memory cannot be allocated.
+*/
+char* kalloc_order ( int order )
+{
+	char* p;
+
+	if ( order == 0 )
+	{
+		return kalloc();
+	}
+
+	if ( order < 0 || order > KMAXORDER )
 	{
-		kmem.freelist = np->next;
+		return 0;
+	}
 
-		// Fill with junk...
-		// memset( ( char* ) np, 1, PGSIZE );
-		memset( ( char* ) np, 1, sizeof( struct node ) );  // JK...
+	if ( kmem.use_lock )
+	{
+		acquire( &kmem.lock );
 	}
 
+	p = buddyalloc( order );
 
 	if ( kmem.use_lock )
 	{
 		release( &kmem.lock );
 	}
 
-	return ( char* ) np;  // np can be null...
+	#if KALLOC_DEBUG
+		if ( p )
+		{
+			memset( p, 5, PGSIZE << order );
+		}
+	#endif
+
+	return p;
+}
+
+
+// _________________________________________________________________________________
+
+// Take a page from the zeroed pool, or return 0 if it's empty
+static char* kzpooltake ( void )
+{
+	struct node* np;
+
+	acquire( &kzpool.lock );
+
+	np = kzpool.freelist;
+
+	if ( np )
+	{
+		kzpool.freelist = np->next;
+		kzpool.nfree   -= 1;
+	}
+
+	release( &kzpool.lock );
+
+	return ( char* ) np;
+}
+
+// Allocate one zeroed page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+char* kzalloc ( void )
+{
+	char* p;
+
+	p = 0;
+
+	if ( kmem.use_lock )
+	{
+		p = kzpooltake();
+	}
+
+	// Zeroed ahead of time, except for the list pointer
+	if ( p )
+	{
+		memset( p, 0, sizeof( struct node ) );
+
+		kzpool.nhit += 1;  // unlocked, only needs to be roughly right
+
+		return p;
+	}
+
+	kzpool.nmiss += 1;
+
+	p = kalloc();
+
+	if ( p )
+	{
+		memset( p, 0, PGSIZE );
+	}
+
+	return p;
+}
+
+/* Zero a free page and add it to the zeroed pool, if the pool
+   isn't full. Called by the scheduler when the CPU has nothing
+   else to do, so one page at a time to keep the CPU responsive.
+   Returns 1 if a page was zeroed, 0 if there is nothing to do.
+*/
+int kzrefill ( void )
+{
+	struct node* np;
+
+	// Unlocked check, worst case the pool goes slightly over
+	if ( kzpool.nfree >= KZPOOL_MAX )
+	{
+		return 0;
+	}
+
+	// Don't take from the pool itself (kalloc's fallback)
+	np = ( struct node* ) kallocpage();
+
+	if ( np == 0 )
+	{
+		return 0;
+	}
+
+	memset( np, 0, PGSIZE );
+
+	acquire( &kzpool.lock );
+
+	np->next        = kzpool.freelist;
+	kzpool.freelist = np;
+	kzpool.nfree   += 1;
+
+	release( &kzpool.lock );
+
+	return 1;
+}
+
+
+// _________________________________________________________________________________
+
+/* Print free memory statistics to the console.
+   Runs when user types ^K on console.
+
+   "Fragmentation" is the percentage of free memory that is not
+   in a block of the largest order, i.e. memory that cannot
+   currently satisfy a KMAXORDER sized request.
+*/
+void kmemdump ( void )
+{
+	uint nfree [ KMAXORDER + 1 ];
+	uint freepages;
+	uint cachedpages;
+	int  order;
+	int  i;
+
+	acquire( &kmem.lock );
+
+	for ( order = 0; order <= KMAXORDER; order += 1 )
+	{
+		nfree[ order ] = kmem.nfree[ order ];
+	}
+
+	release( &kmem.lock );
+
+	// Unlocked read, only needs to be roughly right
+	cachedpages = 0;
+
+	for ( i = 0; i < NCPU; i += 1 )
+	{
+		cachedpages += kcache[ i ].nfree;
+	}
+
+	cprintf( "\norder  blocks  pages\n" );
+
+	freepages = 0;
+
+	for ( order = 0; order <= KMAXORDER; order += 1 )
+	{
+		cprintf( "%d      %d      %d\n", order, nfree[ order ], nfree[ order ] << order );
+
+		freepages += nfree[ order ] << order;
+	}
+
+	cprintf( "cached in per-CPU lists: %d pages\n", cachedpages );
+
+	cprintf( "zeroed pool: %d pages (%d hits, %d misses)\n", kzpool.nfree, kzpool.nhit, kzpool.nmiss );
+
+	freepages += cachedpages + kzpool.nfree;
+
+	cprintf( "free: %d pages (%d KB)\n", freepages, freepages * ( PGSIZE / 1024 ) );
+
+	if ( freepages )
+	{
+		cprintf( "fragmentation: %d%%\n",
+		         100 - ( ( nfree[ KMAXORDER ] << KMAXORDER ) * 100 ) / freepages );
+	}
 }
@@ -0,0 +1,150 @@
+// Kernel configuration
+
+/* Limits on the kernel's tables, set at boot instead of compiled in.
+   The tables grow on demand up to their limit (see allocproc,
+   filealloc, iget, and fdalloc), so a large limit costs nothing
+   until it is used.
+
+   The defaults come from param.h. They can be overridden by the
+   kernel command line, a string in the kernel image, set when
+   building the kernel with
+
+       make qemu KCMDLINE="nproc=256 nfile=1000"
+
+   (or patched into a built kernel, it's the 'kcmdline' symbol).
+   Options are separated by spaces:
+     nproc=N    max number of processes                (NPROC)
+     nfile=N    max number of open files in the system (NOPENFILE_SYS)
+     nofile=N   max number of open files per process   (NOPENFILE_PROC,
+                at most NOFILEMAX)
+     ninode=N   max number of in-memory inodes         (NINODE)
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "kconfig.h"
+
+#ifndef KCMDLINE
+	#define KCMDLINE ""
+#endif
+
+#define KCMDLINEMAX 128
+
+
+struct kconfig kconfig = {
+
+	NPROC,
+	NOPENFILE_SYS,
+	NOPENFILE_PROC,
+	NINODE
+};
+
+char kcmdline [ KCMDLINEMAX ] = KCMDLINE;
+
+
+static struct
+{
+	char* name;
+	int*  value;
+	int   max;
+
+} options [] = {
+
+	{ "nproc",  &kconfig.nproc,  0         },
+	{ "nfile",  &kconfig.nfile,  0         },
+	{ "nofile", &kconfig.nofile, NOFILEMAX },
+	{ "ninode", &kconfig.ninode, 0         }
+};
+
+
+// Set option 'name' (of length namelen) to 'value'
+static void kconfigset ( char* name, int namelen, int value )
+{
+	int i;
+
+	for ( i = 0; i < NELEM( options ); i += 1 )
+	{
+		if ( strlen( options[ i ].name ) == namelen &&
+		     strncmp( options[ i ].name, name, namelen ) == 0 )
+		{
+			break;
+		}
+	}
+
+	if ( i == NELEM( options ) )
+	{
+		cprintf( "kconfig: unknown option in \"%s\"\n", name );
+
+		return;
+	}
+
+	if ( value < 1 || ( options[ i ].max && value > options[ i ].max ) )
+	{
+		cprintf( "kconfig: bad value for %s\n", options[ i ].name );
+
+		return;
+	}
+
+	*( options[ i ].value ) = value;
+}
+
+// Parse the kernel command line
+void kconfiginit ( void )
+{
+	char* s;
+	char* name;
+	int   namelen;
+	int   value;
+
+	s = kcmdline;
+
+	kcmdline[ KCMDLINEMAX - 1 ] = 0;
+
+	while ( *s )
+	{
+		if ( *s == ' ' )
+		{
+			s += 1;
+
+			continue;
+		}
+
+		// name=value
+		name = s;
+
+		while ( *s && *s != '=' && *s != ' ' )
+		{
+			s += 1;
+		}
+
+		namelen = s - name;
+
+		if ( *s != '=' )
+		{
+			cprintf( "kconfig: expected name=value in \"%s\"\n", name );
+
+			continue;
+		}
+
+		s += 1;
+
+		for ( value = 0; *s >= '0' && *s <= '9'; s += 1 )
+		{
+			value = value * 10 + ( *s - '0' );
+		}
+
+		kconfigset( name, namelen, value );
+
+		// Skip whatever is left of a bad value
+		while ( *s && *s != ' ' )
+		{
+			s += 1;
+		}
+	}
+
+	cprintf( "kconfig: nproc %d, nfile %d, nofile %d, ninode %d\n\n",
+
+		kconfig.nproc, kconfig.nfile, kconfig.nofile, kconfig.ninode
+	);
+}
@@ -0,0 +1,10 @@
+// Limits set at boot (see kconfig.c)
+struct kconfig
+{
+	int nproc;   // max number of processes
+	int nfile;   // max number of open files in the system
+	int nofile;  // max number of open files per process
+	int ninode;  // max number of in-memory inodes
+};
+
+extern struct kconfig kconfig;
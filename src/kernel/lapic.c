@@ -141,6 +141,46 @@ void lapicinit ( void )
 	lapicw( TPR, 0 );
 }
 
+/* Send interrupt 'vector' to the CPU whose local APIC ID is 'apicid'.
+   Used to wake up a halted CPU (see cpuidle in proc.c).
+*/
+void lapicipi ( int apicid, int vector )
+{
+	if ( ! lapic )
+	{
+		return;
+	}
+
+	/* An interrupt handler may send an IPI too (timer -> setrunnable
+	   -> cpukick), and overwrite ICRHI between the two writes
+	*/
+	pushcli();
+
+	lapicw( ICRHI, apicid << 24 );
+	lapicw( ICRLO, FIXED | ASSERT | vector );
+
+	while ( lapic[ ICRLO ] & DELIVS )
+	{
+		//
+	}
+
+	popcli();
+}
+
+/* Turn this CPU's periodic timer interrupt on or off.
+   Idle CPUs turn it off so that they stay halted, see cpuidle.
+   The count keeps running, only the interrupt is masked.
+*/
+void lapictimer ( int on )
+{
+	if ( ! lapic )
+	{
+		return;
+	}
+
+	lapicw( TIMER, ( on ? 0 : MASKED ) | PERIODIC | ( T_IRQ0 + IRQ_TIMER ) );
+}
+
 int lapicid ( void )
 {
 	if ( ! lapic )
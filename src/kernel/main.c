@@ -58,9 +58,12 @@ pde_t entrypgdir [];  // Used by entry.S and entryothers.S
 // doing some setup required for memory allocator to work.
 int main ( void )
 {
+	e820init();      // find out how much memory there is (phystop)
 	kinit1( end, P2V( 4 * 1024 * 1024 ) );  // kernel_end..4MB  ?? phys page allocator
 
 	kvmalloc();      // create kernel page table, then switch to it ??
+	kvmenableglobal();  // keep kernel TLB entries across %cr3 loads
+	slabinit();      // kernel object caches
 	mpinit();        // detect other CPUs
 	lapicinit();     // interrupt controller
 	seginit();       // segment descriptors
@@ -71,14 +74,21 @@ int main ( void )
 	vgainit();       // vga
 	displayinit();   // generic display
 	mouseinit();     // mouse
+	profinit();      // sampling profiler
+	kconfiginit();   // table limits from the kernel command line
 	procinit();      // process table
+	shminit();       // shared memory segments
 	trapinit();      // trap vectors
+	timerinit();     // kernel timers
+	futexinit();     // futex wait queues
 	binit();         // buffer cache
+	pcinit();        // file page cache
 	fileinit();      // file table
+	pipeinit();      // pipe cache
 	ideinit();       // disk 
 	startothers();   // start other CPUs
 
-	kinit2( P2V( 4 * 1024 * 1024 ), P2V( PHYSTOP ) );  // 4MB..PHYSTOP  ?? must come after startothers()
+	kinit2( P2V( 4 * 1024 * 1024 ), P2V( phystop ) );  // 4MB..phystop  ?? must come after startothers()
 
 	userinit();      // create first user process
 	mpmain();        // finish this CPU's setup
@@ -97,6 +107,7 @@ int main ( void )
 static void mpenter ( void )
 {
 	switchkvm();
+	kvmenableglobal();
 	seginit();
 	lapicinit();
 	mpmain();
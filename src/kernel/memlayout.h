@@ -6,9 +6,17 @@
 
 //
 #define EXTMEM   0x100000    // Start of extended memory
-#define PHYSTOP  0xE000000   // Top of physical memory (Note: stackoverflow.com/a/29892921)
 #define DEVSPACE 0xFE000000  // Addresses used by memory mapped IO
 
+/* The top of physical memory (phystop) is detected at boot from
+   the BIOS memory map (see e820.c). The kernel maps all physical
+   memory at KERNBASE, so it can use at most PHYSMAX bytes.
+*/
+#define PHYSMAX      ( DEVSPACE - KERNBASE )  // Most physical memory the kernel can use
+#define PHYSDEFAULT  0xE000000   // phystop if there is no memory map (Note: stackoverflow.com/a/29892921)
+#define E820MAP      0x8000      // Where bootasm.S stores the BIOS memory map
+#define E820MAX      32          // Most entries bootasm.S stores there
+
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000             // First kernel virtual address
 #define KERNLINK ( KERNBASE + EXTMEM )  // Address where kernel is linked
@@ -31,6 +39,15 @@
 // Virtual
 #define UMMIO__VGA_MODE13_BUF ( USER_MMIO_BASE + 0 )
 
+
+/* Shared memory segments (see shm.c) are attached below USER_MMIO_BASE.
+   Segment i is always attached at SHM_BASE + i * SHM_MAXSIZE
+*/
+// Make sure to keep SHM_MAXSIZE == SHM_MAXPAGES * PGSIZE and
+// SHM_BASE == USER_MMIO_BASE - NSHM * SHM_MAXSIZE (see param.h)
+#define SHM_MAXSIZE 0x00100000  // 256 * PGSIZE
+#define SHM_BASE    0x7EFF0000  // USER_MMIO_BASE - 16 * SHM_MAXSIZE
+
 // Physical
 #define VGA_MODE13_BUF_ADDR 0xA0000  // physical address
 #define VGA_MODE13_BUF_SIZE 64000    // 320(w) * 200(h)
@@ -49,7 +66,7 @@ TODO:
 	                                    IO devices 
 	         (DEVSPACE) 0xFE00_0000 ->  -----------------------------
 	                                    unmapped/unused?
-	                   P2V(PHYSTOP) ->  -----------------------------
+	                   P2V(phystop) ->  -----------------------------
 	                                    ...
 	                                    free memory
 	                                    (used by?)
@@ -71,6 +88,8 @@ TODO:
 	         (KERNBASE) 0x8000_0000 ->  -----------------------------  <-
 	                                    vga mode13 framebuffer           |
 	                 USER_MMIO_BASE ->  -----------------------------    |
+	                                    shared memory segments           |
+	                       SHM_BASE ->  -----------------------------    |
 	                                    ...                              |
 	                                    free memory                      |
 	                                    (used to grow user heap)         |
@@ -95,7 +114,7 @@ TODO:
 	                             IO devices
 	  (DEVSPACE) 0xFE00_0000 ->  -------------------------
 	                             unmapped/unused?
-	                 PHYSTOP ->  -------------------------
+	                 phystop ->  -------------------------
 	                             ...
 	                             free memory
 	                             (used by kalloc to allocate pages)
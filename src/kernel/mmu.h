@@ -10,6 +10,7 @@
 #define CR0_PG  0x80000000  // Paging
 
 #define CR4_PSE 0x00000010  // Page size extension
+#define CR4_PGE 0x00000080  // Page global enable
 
 
 // ____________________________________________________________________________
@@ -127,6 +128,8 @@ struct segdesc
 #define NPTENTRIES 1024  // # PTEs per page table
 #define PGSIZE     4096  // bytes mapped by a page
 
+#define SUPERPGSIZE ( NPTENTRIES * PGSIZE )  // bytes mapped by a 4MB superpage (PDE_PS)
+
 #define PT_IDX_SHIFT 12  // offset of PT_IDX in a linear address
 #define PD_IDX_SHIFT 22  // offset of PD_IDX in a linear address
 
@@ -181,11 +184,18 @@ struct segdesc
 #define PDE_W  0x02   // Writeable
 #define PDE_U  0x04   // User
 #define PDE_PS 0x80   // Page Size. Enables 4Mbyte "super" page
+#define PDE_G  0x100  // Global (only meaningful when PDE_PS is set)
 
 // Page table entry flags
 #define PTE_P  0x01   // Present
 #define PTE_W  0x02   // Writeable
 #define PTE_U  0x04   // User
+#define PTE_A  0x20   // Accessed. Set by the hardware when the page is read or written
+#define PTE_G  0x100  // Global. Not flushed from the TLB when %cr3 is loaded (if CR4_PGE is set)
+
+// Software-defined page table entry flags (bits 11..9 are ignored by the hardware)
+#define PTE_SHARED  0x200  // Page belongs to a shared memory segment (see shm.c)
+#define PTE_SWAPPED 0x400  // Page is swapped out. PTE_P is clear, address bits hold the swap slot (see swap.c)
 
 // Address in page directory entry
 #define PDE_ADDR( pde )  ( ( uint ) ( pde ) & ~ 0xFFF )
@@ -0,0 +1,293 @@
+// File page cache
+
+/* Caches file data a page (PGSIZE bytes) at a time, indexed by
+   (device, inode number, page number within the file).
+
+   The buffer cache (buf.c) caches disk blocks, which are much
+   smaller than a page. Reading a file through it means going
+   block by block, and the blocks of a big file quickly push each
+   other (and the file system's metadata) out of the cache. Pages
+   here hold whole pages of a file in kalloc'd memory, so repeated
+   reads of a hot file are a page sized memmove each, with no
+   disk access.
+
+   Only regular files (T_FILE) are cached. Directories, inodes,
+   bitmaps and the log keep using the buffer cache.
+
+   How fs.c uses it:
+     . readi  - copies from the page, filling it from disk
+                (through the buffer cache) on a miss
+     . writei - still writes through the buffer cache and log (so
+                crash recovery is unchanged), and also updates the
+                page if it is cached. Pages are never dirty.
+     . itrunc - drops the file's pages
+
+   All uses of a file's pages happen with the file's inode locked,
+   so unlike buffers, pages don't need their own sleeplock. The
+   reference count only stops another file from recycling a page
+   that is in use.
+
+   Lookups hash on (dev, inum, pgno). A page is in the chain of
+   the file page it was last used for (valid or not), pages that
+   were never used aren't in any.
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "pagecache.h"
+
+#define NPCHASH  64
+#define PCHASH( dev, inum, pgno ) ( &pcache.hash[ ( ( ( dev ) * 31 + ( inum ) ) * 31 + ( pgno ) ) % NPCHASH ] )
+
+struct
+{
+	struct spinlock lock;
+
+	struct pcpage   page [ NPCACHE ];
+
+	struct pcpage*  hash [ NPCHASH ];
+
+	/* Doubly-linked list of all pages, through prev and next.
+	   head.next is most recently released,
+	   head.prev is least recently released.
+	*/
+	struct pcpage   head;
+
+	uint            nhit;   // statistics...
+	uint            nmiss;
+
+} pcache;
+
+
+void pcinit ( void )
+{
+	struct pcpage* pg;
+
+	initlock( &pcache.lock, "pcache" );
+
+	pcache.head.prev = &pcache.head;
+	pcache.head.next = &pcache.head;
+
+	for ( pg = pcache.page; pg < pcache.page + NPCACHE; pg += 1 )
+	{
+		pg->next = pcache.head.next;
+		pg->prev = &pcache.head;
+
+		pcache.head.next->prev = pg;
+		pcache.head.next       = pg;
+	}
+}
+
+
+// _________________________________________________________________________________
+
+// Find the valid page 'pgno' of the file (dev, inum), or 0.
+// Caller must hold pcache.lock.
+static struct pcpage* pclookup ( uint dev, uint inum, uint pgno )
+{
+	struct pcpage* pg;
+
+	for ( pg = *PCHASH( dev, inum, pgno ); pg; pg = pg->hnext )
+	{
+		if ( pg->valid && pg->dev == dev && pg->inum == inum && pg->pgno == pgno )
+		{
+			return pg;
+		}
+	}
+
+	return 0;
+}
+
+// Take 'pg' out of its hash chain, if it is in one.
+// Caller must hold pcache.lock.
+static void pcunhash ( struct pcpage* pg )
+{
+	struct pcpage** pp;
+
+	for ( pp = PCHASH( pg->dev, pg->inum, pg->pgno ); *pp; pp = &( *pp )->hnext )
+	{
+		if ( *pp == pg )
+		{
+			*pp = pg->hnext;
+
+			break;
+		}
+	}
+
+	pg->hnext = 0;
+}
+
+/* Return the cached page 'pgno' of the file (dev, inum).
+   If it is not cached, recycle the least recently used page,
+   and return it with valid == 0 for the caller to fill in.
+   Returns 0 if all pages are in use, or there is no memory
+   for a new page.
+*/
+struct pcpage* pcget ( uint dev, uint inum, uint pgno )
+{
+	struct pcpage* pg;
+	char*          mem;
+
+	acquire( &pcache.lock );
+
+	pg = pclookup( dev, inum, pgno );
+
+	if ( pg )
+	{
+		pg->refcnt += 1;
+
+		pcache.nhit += 1;
+
+		release( &pcache.lock );
+
+		return pg;
+	}
+
+	// Not cached, recycle the least recently used page
+	for ( pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev )
+	{
+		if ( pg->refcnt == 0 )
+		{
+			pcunhash( pg );
+
+			pg->valid  = 0;
+			pg->dev    = dev;
+			pg->inum   = inum;
+			pg->pgno   = pgno;
+			pg->refcnt = 1;
+
+			pg->hnext = *PCHASH( dev, inum, pgno );
+
+			*PCHASH( dev, inum, pgno ) = pg;
+
+			pcache.nmiss += 1;
+
+			break;
+		}
+	}
+
+	release( &pcache.lock );
+
+	if ( pg == &pcache.head )
+	{
+		return 0;
+	}
+
+	// First use of this page, get memory for it
+	if ( pg->data == 0 )
+	{
+		mem = kalloc();
+
+		if ( mem == 0 )
+		{
+			pcrelse( pg );
+
+			return 0;
+		}
+
+		pg->data = mem;
+	}
+
+	return pg;
+}
+
+/* Release a page returned by pcget, and move it to the front
+   of the LRU list.
+*/
+void pcrelse ( struct pcpage* pg )
+{
+	acquire( &pcache.lock );
+
+	if ( pg->refcnt < 1 )
+	{
+		panic( "pcrelse" );
+	}
+
+	pg->refcnt -= 1;
+
+	if ( pg->refcnt == 0 )
+	{
+		pg->next->prev = pg->prev;
+		pg->prev->next = pg->next;
+
+		pg->next = pcache.head.next;
+		pg->prev = &pcache.head;
+
+		pcache.head.next->prev = pg;
+		pcache.head.next       = pg;
+	}
+
+	release( &pcache.lock );
+}
+
+/* A write to the file (dev, inum) changed n bytes at offset 'off'.
+   If that page is cached, copy the new bytes into it too.
+   The bytes must not cross a page boundary.
+*/
+void pcupdate ( uint dev, uint inum, uint off, char* src, uint n )
+{
+	struct pcpage* pg;
+	uint           pgno;
+
+	pgno = off / PGSIZE;
+
+	acquire( &pcache.lock );
+
+	pg = pclookup( dev, inum, pgno );
+
+	if ( pg )
+	{
+		memmove( pg->data + ( off % PGSIZE ), src, n );
+	}
+
+	release( &pcache.lock );
+}
+
+// Drop all cached pages of the file (dev, inum).
+// Called when the file is truncated.
+void pcinval ( uint dev, uint inum )
+{
+	struct pcpage* pg;
+
+	acquire( &pcache.lock );
+
+	for ( pg = pcache.page; pg < pcache.page + NPCACHE; pg += 1 )
+	{
+		if ( pg->dev == dev && pg->inum == inum )
+		{
+			pg->valid = 0;
+		}
+	}
+
+	release( &pcache.lock );
+}
+
+
+// _________________________________________________________________________________
+
+// Print page cache statistics to the console.
+// Runs when user types ^K on console (after swapdump).
+void pcdump ( void )
+{
+	struct pcpage* pg;
+	int            nvalid;
+
+	acquire( &pcache.lock );
+
+	nvalid = 0;
+
+	for ( pg = pcache.page; pg < pcache.page + NPCACHE; pg += 1 )
+	{
+		nvalid += pg->valid;
+	}
+
+	cprintf( "\npage cache: %d/%d pages cached, %d hits, %d misses\n",
+
+		nvalid, NPCACHE, pcache.nhit, pcache.nmiss
+	);
+
+	release( &pcache.lock );
+}
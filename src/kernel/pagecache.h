@@ -0,0 +1,16 @@
+// A page of file data, cached by pagecache.c
+struct pcpage
+{
+	int            valid;     // data has been read from disk
+	uint           dev;       // device number
+	uint           inum;      // inode number
+	uint           pgno;      // page number within the file (file offset / PGSIZE)
+
+	uint           refcnt;
+
+	struct pcpage* hnext;     // hash chain (see pagecache.c)
+	struct pcpage* prev;      // LRU list
+	struct pcpage* next;
+
+	char*          data;      // PGSIZE bytes (from kalloc, 0 until first use)
+};
@@ -2,12 +2,19 @@
 
 #define KSTACKSIZE      4096                 // size of per-process kernel stack
 
+/* Defaults for the limits in kconfig.c, which can be changed
+   at boot with the kernel command line
+*/
 #define NPROC           64                   // max number of processes
+#define NPRIO           4                    // number of scheduler priority levels
+#define NPIDHASH        64                   // buckets in the pid hash table (see proc.c)
 
 #define NOPENFILE_PROC  16                   // max number of open files per process
 #define NOPENFILE_SYS   100                  // max number of open files per system ??
 #define NINODE          50                   // max number of active inodes
 
+#define NOFILEMAX       1024                 // largest per process limit, one page of file pointers
+
 #define NDEV            10                   // max major device number
 #define ROOTDEV         1                    // device number of file system root disk ??
 
@@ -16,6 +23,14 @@
 #define MAXOPBLOCKS     10                   // max number of blocks an FS syscall can write at once
 #define LOGSIZE         ( MAXOPBLOCKS * 3 )  // number of blocks in the log
 #define NBUF            ( MAXOPBLOCKS * 3 )  // number of buffers in the buffer cache
+#define NPCACHE         64                   // number of pages in the file page cache
 
 #define FSSIZE          4000                 // size of file system in blocks
 #define FSNINODE        200                  // number of inodes in file system
+#define SWAPSIZE        8192                 // size of swap area in blocks (placed after the file system)
+
+#define NSHM            16                   // max number of shared memory segments
+#define SHM_MAXPAGES    256                  // max size of a shared memory segment (pages)
+
+#define KALLOC_DEBUG    0                    // fill allocated and freed pages with junk
+#define KMAXORDER       10                   // largest physically contiguous allocation is 2^KMAXORDER pages
@@ -33,6 +33,28 @@ struct pipe {
 	int  writeopen;          // write fd is still open
 };
 
+/* Pipes are allocated from a slab cache rather than one
+   page each (see slab.c). The lock is initialized once by
+   the cache's constructor, and is always released before
+   a pipe is freed.
+*/
+static struct slabcache* pipecache;
+
+static void pipector ( void* p )
+{
+	initlock( &( ( struct pipe* ) p )->lock, "pipe" );
+}
+
+void pipeinit ( void )
+{
+	pipecache = slabcreate( "pipe", sizeof( struct pipe ), pipector );
+
+	if ( pipecache == 0 )
+	{
+		panic( "pipeinit" );
+	}
+}
+
 /* Create a pipe.
    Also allocate and set file structures for its read and write ends...
 */
@@ -61,10 +83,7 @@ int pipealloc ( struct file** f0, struct file** f1 )
 
 
 	// Allocate space to hold the pipe
-	/* Note: allocates one page regardless of
-	   sizeof( struct pipe ) including PIPESIZE
-	*/
-	p = ( struct pipe* ) kalloc();
+	p = ( struct pipe* ) slaballoc( pipecache );
 
 	if ( p == 0 )
 	{
@@ -77,8 +96,6 @@ int pipealloc ( struct file** f0, struct file** f1 )
 	p->nwrite    = 0;
 	p->nread     = 0;
 
-	initlock( &p->lock, "pipe" );
-
 
 	// Set f0 as read end of pipe
 	( *f0 )->type     = FD_PIPE;
@@ -98,7 +115,7 @@ bad:
 
 	if ( p )
 	{
-		kfree( ( char* ) p );
+		slabfree( pipecache, p );
 	}
 
 	if ( *f0 )
@@ -151,7 +168,7 @@ void pipeclose ( struct pipe* p, int writable )
 	{
 		release( &p->lock );
 
-		kfree( ( char* ) p );
+		slabfree( pipecache, p );
 	}
 	/* If only one end of the pipe is closed so far,
 	   we are done for now
@@ -31,8 +31,7 @@ Context switching
 		       trap                                     >
 		       yield                                    >
 		       sched                                    >
-		       swtch( &p->context, mycpu()->scheduler ) >
-		       switchkvm
+		       swtch( &p->context, mycpu()->scheduler )
 		   )
 		. Context switch to the new process's kernel thread
 		  (via switchuvm                              >
@@ -44,6 +43,107 @@ Context switching
 
 	xv6 uses two context switches because the scheduler runs on its
 	own stack in order to simplify cleaning up user processes... ??
+
+	The scheduler does not switch back to kpgdir between two
+	processes. Every page table has the same kernel part (see
+	setupkvm), so the scheduler can keep running on the previous
+	process's page table until it switches to the next one. This
+	saves a %cr3 load (and the resulting TLB flush) per switch.
+	See scheduler for when it does need to switch to kpgdir.
+*/
+
+/*
+Run queues
+
+	Each CPU has its own queue of RUNNABLE processes, with its own
+	lock. The scheduler takes the process at the head of its CPU's
+	queue, and a process that stops running goes to the tail of the
+	queue of the CPU it ran on (p->cpu). Both are O(1), and CPUs
+	don't contend on a lock unless one wakes up or steals another's
+	process. A CPU whose queue is empty steals a process from the
+	first non-empty queue it finds.
+
+	The run queue lock of the CPU a process is running on is the
+	lock held across swtch, in both directions (previously this was
+	ptable.lock):
+	  . yield, sleep and exit acquire runqs[ p->cpu ].lock before
+	    calling sched
+	  . the scheduler holds its queue's lock while picking a process
+	    and switching to it. The process releases it (in yield,
+	    sleep, or forkret)
+
+	This means no other CPU can take a process off a queue, wake it
+	up, or free its stack until it has completely switched away.
+
+	Priorities (multi-level feedback queue):
+	  . a run queue is really NPRIO queues, one per priority level.
+	    The scheduler runs the processes of the highest level (0)
+	    first, round robin within a level
+	  . a process may run for QUANTUM( p->prio ) ticks at its level
+	    (longer for lower levels), counting all its runs, before it
+	    is moved down a level. So CPU hogs sink, while processes
+	    that mostly sleep (sh, keditor) stay up and get the CPU as
+	    soon as they wake up (see schedtick)
+	  . every BOOSTTICKS ticks, all processes go back up to their
+	    base level (p->nice), so that sunk processes don't starve
+	    and a process that turns interactive gets its priority back
+	  . p->nice is set with the nice and setpriority system calls
+
+	Affinity and balancing:
+	  . a process stays on the CPU it last ran on (p->cpu), where
+	    its memory may still be in the caches and TLB
+	  . p->affinity is the set of CPUs it may run on at all (see the
+	    setaffinity system call). A process is never run, stolen or
+	    woken up on a CPU outside it
+	  . every BALANCETICKS ticks a busy CPU evens out the load
+	    between itself and the busiest CPU (rqbalance). A CPU with
+	    nothing to do steals right away (rqsteal)
+	  . c->nmigrate counts the processes moved to CPU c
+
+	Idle CPUs:
+	  . a CPU with nothing to run, steal, or zero halts (cpuidle)
+	    instead of spinning, until an interrupt arrives. It sets
+	    c->idle first
+	  . whoever puts a process on a halted CPU's queue sends it a
+	    wakeup IPI. If the process goes to a busy CPU's queue, a
+	    halted CPU is woken up to steal it (see cpukick)
+	  . CPUs other than 0 also mask their timer interrupt while
+	    halted, as they have no use for it (timers run on CPU 0,
+	    see timer.c). CPU 0 keeps ticking to keep time
+
+	Process lookup:
+	  . a process is found by pid through a hash table
+	    (ptable.pidhash, chained through p->pidnext), so kill and
+	    friends don't scan the whole table
+	  . each process keeps a list of its children (p->children,
+	    linked through p->sibling), so wait and exit only visit
+	    the caller's own children
+	  . a process is added to both when fork or clone is done
+	    setting it up (procadd), and removed by the wait or join
+	    that reaps it
+
+	Accounting:
+	  . p->acct counts the ticks a process ran in user mode and
+	    in the kernel (accttick, called by trap on every timer
+	    interrupt), its context switches (sched), page faults
+	    (trap, swapfault) and I/O (bread, bwrite, fileread,
+	    filewrite). Only the process itself or the CPU running it
+	    touches the counters, so they are plain increments
+	  . wait adds a reaped child's usage to p->cacct
+	  . c->utime, c->stime and c->idletime do the same for CPUs
+	  . see the getrusage and getprocs system calls
+
+	Locks:
+	  . ptable.lock protects allocation (UNUSED, EMBRYO), the pid
+	    hash, and the parent and child relationship (exit, wait)
+	  . sleepqs[ i ].lock protects the sleep queue, and the SLEEPING
+	    state and chan of the processes in it
+	  . runqs[ i ].lock protects the queue, and the RUNNABLE and
+	    RUNNING states of the processes in it or running on CPU i
+	  . p->cpu only changes while holding both the old and the new
+	    CPU's queue locks (see rqsteal)
+	  . locks are acquired in this order: ptable.lock, sleep queue
+	    lock, run queue lock
 */
 
 #include "types.h"
@@ -52,8 +152,12 @@ Context switching
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "trap.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "timer.h"
+#include "kconfig.h"
+#include "rusage.h"
 
 struct
 {
@@ -61,24 +165,90 @@ struct
 	*/
 	struct spinlock lock;
 
-	struct proc     proc [ NPROC ];
+	/* All processes, oldest (lowest pid) first, linked through
+	   p->allnext and p->allprev. The struct procs come from a slab cache,
+	   up to kconfig.nproc of them.
+	*/
+	struct proc*    head;
+	struct proc*    tail;
+	int             n;
+
+	struct proc*    pidhash [ NPIDHASH ];
 
 } ptable;
 
+#define PIDHASH( pid )  ( &ptable.pidhash[ ( uint ) ( pid ) % NPIDHASH ] )
+
+#define QUANTUM( prio )  ( 1 << ( prio ) )  // ticks a process may run at a level
+#define BOOSTTICKS       100                 // how often processes go back to their base level
+#define BALANCETICKS     20                  // how often a busy CPU runs rqbalance
+
+// Per-CPU run queue
+struct runq
+{
+	struct spinlock lock;
+	struct proc*    head [ NPRIO ];  // one queue per priority level, linked through p->rqnext
+	struct proc*    tail [ NPRIO ];
+	int             n;               // number of processes in queue
+	uint            boosted;         // last boost (ticks / BOOSTTICKS)
+};
+
+static struct runq runqs [ NCPU ];
+
+/* Sleep queues. Processes sleeping on a chan are kept in the queue
+   that chan hashes to, so wakeup only looks at processes that are
+   likely sleeping on chan (instead of the whole process table).
+*/
+#define NSLEEPQBITS  6
+#define NSLEEPQ      ( 1 << NSLEEPQBITS )  // number of sleep queues
+
+struct sleepq
+{
+	struct spinlock lock;
+	struct proc*    head;  // oldest sleeper first, linked through p->sqnext
+};
+
+static struct sleepq sleepqs [ NSLEEPQ ];
+
+// Fibonacci hashing, chans are addresses with few useful low bits
+#define SLEEPQ( chan )  ( &sleepqs[ ( ( uint ) ( chan ) * 2654435761U ) >> ( 32 - NSLEEPQBITS ) ] )
+
 static struct proc* initproc;
 int                 nextpid = 1;
 
+static struct slabcache* proccache;
+static struct slabcache* vmcache;
+
 extern void forkret ( void );
 extern void trapret ( void );
 
-static void wakeup1 ( void* chan );
 
 
 // _________________________________________________________________________________
 
 void procinit ( void )
 {
+	int i;
+
 	initlock( &ptable.lock, "ptable" );
+
+	for ( i = 0; i < NCPU; i += 1 )
+	{
+		initlock( &runqs[ i ].lock, "runq" );
+	}
+
+	for ( i = 0; i < NSLEEPQ; i += 1 )
+	{
+		initlock( &sleepqs[ i ].lock, "sleepq" );
+	}
+
+	proccache = slabcreate( "proc", sizeof( struct proc ), 0 );
+	vmcache   = slabcreate( "vmspace", sizeof( struct vmspace ), 0 );
+
+	if ( proccache == 0 || vmcache == 0 )
+	{
+		panic( "procinit" );
+	}
 }
 
 // Must be called with interrupts disabled
@@ -135,8 +305,39 @@ struct proc* myproc ( void )
 
 // _________________________________________________________________________________
 
-/* Look in the process table for an UNUSED proc.
-   If found, change state to EMBRYO and initialize a kernel stack.
+/* Give back a proc that is no longer used (from allocproc).
+   Caller must hold ptable.lock, and must have taken p out of
+   the pid hash if it was in it.
+*/
+static void procfree ( struct proc* p )
+{
+	if ( p->allprev )
+	{
+		p->allprev->allnext = p->allnext;
+	}
+	else
+	{
+		ptable.head = p->allnext;
+	}
+
+	if ( p->allnext )
+	{
+		p->allnext->allprev = p->allprev;
+	}
+	else
+	{
+		ptable.tail = p->allprev;
+	}
+
+	ptable.n -= 1;
+
+	p->state = UNUSED;
+
+	slabfree( proccache, p );
+}
+
+/* Allocate a proc (unless there are kconfig.nproc already).
+   If successful, change state to EMBRYO and initialize a kernel stack.
    Otherwise return 0.
 
    allocproc is designed to be used both by userinit (when creating the
@@ -149,24 +350,45 @@ static struct proc* allocproc ( void )
 
 	acquire( &ptable.lock );
 
-	// Scan process table for an available slot
-	for ( p = ptable.proc; p < &ptable.proc[ NPROC ]; p += 1 )
+	p = ptable.n < kconfig.nproc ? slaballoc( proccache ) : 0;
+
+	if ( p == 0 )
 	{
-		if ( p->state == UNUSED )
-		{
-			goto found;
-		}
+		release( &ptable.lock );
+
+		return 0;
 	}
 
-	release( &ptable.lock );
+	memset( p, 0, sizeof( struct proc ) );
 
-	return 0;
+	// Newest last, so the list stays in pid order
+	p->allprev = ptable.tail;
+
+	if ( ptable.tail )
+	{
+		ptable.tail->allnext = p;
+	}
+	else
+	{
+		ptable.head = p;
+	}
 
-found:
+	ptable.tail  = p;
+	ptable.n    += 1;
 
 	p->state = EMBRYO;   // mark as used, but not ready to run yet
 	p->pid   = nextpid;  // give unique PID
 
+	p->insyscall   = 0;
+	p->reclaimself = 0;
+	p->swapbusy    = 0;
+
+	p->nice    = 0;
+	p->quantum = 0;
+	p->boosted = - 1;  // rqpush sets p->prio from p->nice
+
+	p->affinity = ~ 0;  // any CPU
+
 	nextpid += 1;
 
 	release( &ptable.lock );
@@ -177,7 +399,11 @@ found:
 
 	if ( p->kstack == 0 )
 	{
-		p->state = UNUSED;
+		acquire( &ptable.lock );
+
+		procfree( p );
+
+		release( &ptable.lock );
 
 		return 0;
 	}
@@ -251,81 +477,143 @@ found:
 	return p;
 }
 
+/* Make p findable by pid, and add it to parent's children
+   (parent is 0 for the first process).
+   Caller must hold ptable.lock.
+*/
+static void procadd ( struct proc* p, struct proc* parent )
+{
+	struct proc** bucket;
 
-// _________________________________________________________________________________
+	bucket = PIDHASH( p->pid );
 
-// Set up first user process.
-void userinit ( void )
+	p->pidnext = *bucket;
+	*bucket    = p;
+
+	p->parent   = parent;
+	p->children = 0;
+	p->sibling  = 0;
+
+	if ( parent )
+	{
+		p->sibling       = parent->children;
+		parent->children = p;
+	}
+}
+
+/* Remove p from the pid hash (it is being reaped).
+   Caller must hold ptable.lock, and unlink p from its parent's
+   children.
+*/
+static void pidremove ( struct proc* p )
 {
-	// extern char _binary_initcode_start[], _binary_initcode_size[];
-	extern char _binary_img_initcode_start [],
-	            _binary_img_initcode_size  [];  // JK, new path
+	struct proc** pp;
+
+	for ( pp = PIDHASH( p->pid ); *pp != p; pp = &( *pp )->pidnext )
+	{
+		;
+	}
+
+	*pp = p->pidnext;
 
+	p->pidnext = 0;
+}
+
+/* Return the process with the given pid, or 0 if there is none.
+   Caller must hold ptable.lock.
+*/
+static struct proc* pidlookup ( int pid )
+{
 	struct proc* p;
 
+	for ( p = *PIDHASH( pid ); p != 0; p = p->pidnext )
+	{
+		if ( p->pid == pid )
+		{
+			return p;
+		}
+	}
+
+	return 0;
+}
 
-	// Allocate an UNUSED process from the process table, and allocate
-	// and initialize its kernel stack
-	p = allocproc();
 
-	initproc = p;
+// _________________________________________________________________________________
 
+/* Address spaces (struct vmspace)
+   fork gives the child its own copy of the parent's address space,
+   clone shares it with the new thread. The page table is freed when
+   the last process using it is gone (see wait and exec).
+*/
 
-	// Create a page table for the process
-	// The page table will first only hold mappings for memory used
-	// by the kernel...
-	if ( ( p->pgdir = setupkvm() ) == 0 )
+// Allocate a vmspace for pgdir (of sz bytes of user memory).
+// Returns 0 if out of memory.
+struct vmspace* vmcreate ( pde_t* pgdir, uint sz )
+{
+	struct vmspace* vm;
+
+	vm = slaballoc( vmcache );
+
+	if ( vm == 0 )
 	{
-		panic( "userinit: out of memory?" );
+		return 0;
 	}
 
+	vm->pgdir = pgdir;
+	vm->sz    = sz;
+	vm->ref   = 1;
+	vm->busy  = 0;
 
-	// Copy initcode's binary into the process's user-space memory
-	inituvm(
+	return vm;
+}
 
-		p->pgdir,
-		// _binary_initcode_start,
-		// ( int ) _binary_initcode_size
-		_binary_img_initcode_start,
-		( int ) _binary_img_initcode_size
-	);
+// A process is done with vm. The last one frees the page table.
+void vmput ( struct vmspace* vm )
+{
+	int ref;
 
-	// initcode's binary is expected to be equal to or less than one page in size
-	p->sz = PGSIZE;
+	acquire( &ptable.lock );
 
+	vm->ref -= 1;
 
-	/* Write values in the new process's trapframe that make it seem
-	   like the process entered the kernel via an interrupt
+	ref = vm->ref;
 
-	   Set tf->eip to zero so that the process starts executing at user-space
-	   location zero on reti by trapret
-	*/
-	memset( p->tf, 0, sizeof( *p->tf ) );
+	release( &ptable.lock );
 
-	p->tf->cs     = ( SEG_UCODE << 3 ) | DPL_USER;
-	p->tf->ds     = ( SEG_UDATA << 3 ) | DPL_USER;
-	p->tf->es     = p->tf->ds;
-	p->tf->ss     = p->tf->ds;
+	if ( ref > 0 )
+	{
+		return;
+	}
 
-	p->tf->eflags = FL_IF;   // enable hardware interrupts ??
-	p->tf->esp    = PGSIZE;  // the process's largest valid virtual address. Why ??
-	p->tf->eip    = 0;       // beginning (entry point) of initcode.S
+	freevm( vm->pgdir );
 
+	slabfree( vmcache, vm );
+}
 
-	// Set process name. For debugging
-	safestrcpy( p->name, "initcode", sizeof( p->name ) );
+/* Keep other threads from changing vm's page table and size
+   until vmunlock. Sleeps, as allocating memory can sleep (swap).
+*/
+static void vmlock ( struct vmspace* vm )
+{
+	acquire( &ptable.lock );
 
-	// Set cwd to root directory...
-	p->cwd = namei( "/" );
+	while ( vm->busy )
+	{
+		sleep( vm, &ptable.lock );
+	}
 
+	vm->busy = 1;
 
-	// This assignment to p->state lets other cores
-	// run this process. The acquire forces the above
-	// writes to be visible, and the lock is also needed
-	// because the assignment might not be atomic.
+	release( &ptable.lock );
+}
+
+static void vmunlock ( struct vmspace* vm )
+{
 	acquire( &ptable.lock );
 
-	p->state = RUNNABLE;  // Mark the process as avaialble for scheduling
+	vm->busy = 0;
+
+	wakeup( vm );
 
 	release( &ptable.lock );
 }
@@ -333,122 +621,942 @@ void userinit ( void )
 
 // _________________________________________________________________________________
 
-// Create a new process copying p as the parent.
-// Sets up stack to return as if from system call.
-// Caller must set state of returned proc to RUNNABLE.
-
-// How does a pid of zero (child) get returned ??
-int fork ( void )
+/* Add p to the tail of its level's queue in rq.
+   If a boost happened since p was last queued, p goes back
+   to its base level first.
+   Caller must hold rq->lock.
+*/
+static void rqpush ( struct runq* rq, struct proc* p )
 {
-	struct proc* curproc;
-	struct proc* newproc;
-	int          i,
-	             pid;
+	uint epoch;
 
-	//
-	curproc = myproc();
-
-	// Allocate process
-	newproc = allocproc();
+	epoch = ticks / BOOSTTICKS;
 
-	if ( newproc == 0 )
+	if ( p->boosted != epoch )
 	{
-		return - 1;
+		p->prio    = p->nice;
+		p->quantum = 0;
+		p->boosted = epoch;
 	}
 
-	// Setup its page table as a copy of curproc's
-	newproc->pgdir = copyuvm( curproc->pgdir, curproc->sz );
+	p->rqnext = 0;
 
-	if ( newproc->pgdir == 0 )
+	if ( rq->tail[ p->prio ] )
 	{
-		kfree( newproc->kstack );
-
-		newproc->kstack = 0;
-		newproc->state  = UNUSED;
-
-		return - 1;
+		rq->tail[ p->prio ]->rqnext = p;
+	}
+	else
+	{
+		rq->head[ p->prio ] = p;
 	}
 
-	newproc->parent = curproc;
-	newproc->sz     = curproc->sz;
+	rq->tail[ p->prio ] = p;
 
-	// Use same trapframe as parent
-	/* This also has effect that the child will resume execution at the
-	   same point (tf->eip) as the parent.
-	   This corresponds to the point after the parent's call to fork.
-	*/
-	*( newproc->tf ) = *( curproc->tf );
+	rq->n += 1;
+}
 
-	// Clear %eax so that fork returns 0 in the child.
-	newproc->tf->eax = 0;
+/* Remove and return the first process p in rq for which ok( p, cpu )
+   is true, highest level first, or 0 if there is none.
+   Caller must hold rq->lock.
+*/
+static struct proc* rqtake ( struct runq* rq, int ( *ok ) ( struct proc*, int ), int cpu )
+{
+	struct proc** pp;
+	struct proc*  p;
+	struct proc*  prev;
+	int           prio;
 
-	// Copy file descriptors
-	for ( i = 0; i < NOPENFILE_PROC; i += 1 )
+	for ( prio = 0; prio < NPRIO; prio += 1 )
 	{
-		if ( curproc->ofile[ i ] )
+		prev = 0;
+
+		for ( pp = &rq->head[ prio ]; ( p = *pp ) != 0; pp = &p->rqnext )
 		{
-			newproc->ofile[ i ] = filedup( curproc->ofile[ i ] );
-		}
-	}
+			if ( ! ok( p, cpu ) )
+			{
+				prev = p;
 
-	newproc->cwd = idup( curproc->cwd );
+				continue;
+			}
 
-	safestrcpy( newproc->name, curproc->name, sizeof( curproc->name ) );
+			*pp = p->rqnext;  // unlink
 
-	pid = newproc->pid;  //
+			if ( rq->tail[ prio ] == p )
+			{
+				rq->tail[ prio ] = prev;
+			}
 
-	acquire( &ptable.lock );
+			p->rqnext = 0;
 
-	newproc->state = RUNNABLE;
+			rq->n -= 1;
 
-	release( &ptable.lock );
+			return p;
+		}
+	}
 
-	return pid;
+	return 0;
 }
 
+// Can p run on CPU 'cpu'?
+// Not if swap.c is busy with its page table, or its affinity excludes cpu.
+static int canrun ( struct proc* p, int cpu )
+{
+	return ! p->swapbusy && ( p->affinity & ( 1 << cpu ) );
+}
 
-// _________________________________________________________________________________
-
-// Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
-int growproc ( int n )
+// Is p's affinity excluding CPU 'cpu'? (see setaffinity)
+static int mustleave ( struct proc* p, int cpu )
 {
-	struct proc* curproc;
-	uint         sz;
+	return ( p->affinity & ( 1 << cpu ) ) == 0;
+}
 
-	//
-	curproc = myproc();
+/* Unlocked check for a process in rq that CPU 'cpu' could run.
+   The lists may change under us, so the walk is bounded and the
+   answer is only a hint.
+*/
+static int rqhaswork ( struct runq* rq, int cpu )
+{
+	struct proc* p;
+	int          prio,
+	             n;
 
-	sz = curproc->sz;
+	if ( rq->n == 0 )
+	{
+		return 0;
+	}
 
-	// Allocate n pages and add mappings
-	if ( n > 0 )
+	for ( prio = 0; prio < NPRIO; prio += 1 )
 	{
-		sz = allocuvm( curproc->pgdir, sz, sz + n );
+		n = 0;
 
-		if ( sz == 0 )
+		for ( p = rq->head[ prio ]; p && n < kconfig.nproc; p = p->rqnext )
 		{
-			return - 1;
+			if ( canrun( p, cpu ) )
+			{
+				return 1;
+			}
+
+			n += 1;
 		}
 	}
 
-	// Deallocate abs(n) pages and remove mappings
-	else if ( n < 0 )
+	return 0;
+}
+
+/* Move every process in rq back to its base level.
+   Caller must hold rq->lock.
+*/
+static void rqboost ( struct runq* rq, uint epoch )
+{
+	struct proc* list;
+	struct proc* p;
+	int          prio;
+
+	rq->boosted = epoch;
+
+	for ( prio = 1; prio < NPRIO; prio += 1 )
 	{
-		sz = deallocuvm( curproc->pgdir, sz, sz + n );
+		list = rq->head[ prio ];
+
+		rq->head[ prio ] = 0;
+		rq->tail[ prio ] = 0;
 
-		if ( sz == 0 )
+		while ( list )
 		{
-			return - 1;
+			p    = list;
+			list = p->rqnext;
+
+			rq->n -= 1;
+
+			rqpush( rq, p );  // to p->nice, since p->boosted != epoch
 		}
 	}
+}
 
-	curproc->sz = sz;
+/* Remove and return the next process to run from rq, or 0 if there
+   is none. Processes that can't run on rq's CPU are skipped
+   (see canrun).
+   Caller must hold rq->lock.
+*/
+static struct proc* rqnext ( struct runq* rq )
+{
+	uint epoch;
 
-	switchuvm( curproc );
+	epoch = ticks / BOOSTTICKS;
 
-	return 0;
-}
+	if ( rq->boosted != epoch )
+	{
+		rqboost( rq, epoch );
+	}
+
+	return rqtake( rq, canrun, rq - runqs );
+}
+
+/* A process was just added to CPU i's run queue.
+   If CPU i is halted, wake it up. Otherwise the process has to wait
+   for CPU i, so wake up some other halted CPU to steal it instead.
+*/
+static void cpukick ( int i )
+{
+	int j;
+
+	if ( cpus[ i ].idle == 0 )
+	{
+		for ( j = 0; j < ncpu; j += 1 )
+		{
+			if ( cpus[ j ].idle )
+			{
+				break;
+			}
+		}
+
+		if ( j == ncpu )
+		{
+			return;
+		}
+
+		i = j;
+	}
+
+	// Only the one who clears c->idle sends the IPI
+	if ( xchg( &cpus[ i ].idle, 0 ) )
+	{
+		lapicipi( cpus[ i ].apicid, T_IRQ0 + IRQ_WAKEUP );
+	}
+}
+
+// Lock the run queues of CPUs a and b, always in CPU order to avoid deadlock
+static void rqlock2 ( int a, int b )
+{
+	if ( a > b )
+	{
+		rqlock2( b, a );
+
+		return;
+	}
+
+	acquire( &runqs[ a ].lock );
+
+	if ( b != a )
+	{
+		acquire( &runqs[ b ].lock );
+	}
+}
+
+static void rqunlock2 ( int a, int b )
+{
+	if ( b != a )
+	{
+		release( &runqs[ b ].lock );
+	}
+
+	release( &runqs[ a ].lock );
+}
+
+// Number of processes queued on or running on CPU i (unlocked)
+static int cpuload ( int i )
+{
+	return runqs[ i ].n + ( cpus[ i ].proc != 0 );
+}
+
+// Least loaded CPU that p may run on, preferring p->cpu on ties
+static int pickcpu ( struct proc* p )
+{
+	int i,
+	    best;
+
+	best = p->cpu;
+
+	for ( i = 0; i < ncpu; i += 1 )
+	{
+		if ( ( p->affinity & ( 1 << i ) ) == 0 )
+		{
+			continue;
+		}
+
+		if ( ( p->affinity & ( 1 << best ) ) == 0 || cpuload( i ) < cpuload( best ) )
+		{
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+/* Add p to CPU 'to's run queue, p->cpu becomes 'to'.
+   p must be RUNNABLE, not on any run queue, and not running.
+*/
+static void rqmove ( struct proc* p, int to )
+{
+	int from;
+
+	from = p->cpu;
+
+	rqlock2( from, to );
+
+	p->cpu = to;
+
+	rqpush( &runqs[ to ], p );
+
+	if ( from != to )
+	{
+		cpus[ to ].nmigrate += 1;
+	}
+
+	rqunlock2( from, to );
+
+	cpukick( to );
+}
+
+/* Mark p RUNNABLE, and add it to the run queue of the CPU
+   it last ran on (p->cpu), unless its affinity no longer
+   allows it to run there.
+   Caller must make sure p is not on a run queue or running,
+   for ex. by holding the sleep queue lock while p is SLEEPING.
+*/
+static void setrunnable ( struct proc* p )
+{
+	struct runq* rq;
+	int          cpu;
+
+	cpu = p->cpu;  // p can be taken by another CPU once rq->lock is released
+	rq  = &runqs[ cpu ];
+
+	/* If p is on its way to sleep, it holds rq->lock until it
+	   has switched away. So by the time we get the lock, it is
+	   safe to let another CPU run it.
+	*/
+	acquire( &rq->lock );
+
+	p->state = RUNNABLE;
+
+	if ( p->affinity & ( 1 << cpu ) )
+	{
+		rqpush( rq, p );
+
+		release( &rq->lock );
+
+		cpukick( cpu );
+
+		return;
+	}
+
+	release( &rq->lock );
+
+	// p has fully switched away, nobody else will touch it
+	rqmove( p, pickcpu( p ) );
+}
+
+/* Move a process from another CPU's run queue to CPU me's queue.
+   Returns 1 if a process was moved, 0 if there was nothing that
+   CPU me can run.
+   Called by the scheduler when its queue is empty.
+*/
+static int rqsteal ( int me )
+{
+	struct proc* p;
+	int          i,
+	             n;
+
+	for ( n = 1; n < ncpu; n += 1 )
+	{
+		i = ( me + n ) % ncpu;
+
+		// Unlocked peek, don't take locks of idle CPUs
+		if ( runqs[ i ].n == 0 )
+		{
+			continue;
+		}
+
+		rqlock2( me, i );
+
+		p = rqtake( &runqs[ i ], canrun, me );
+
+		if ( p )
+		{
+			p->cpu = me;
+
+			rqpush( &runqs[ me ], p );
+
+			cpus[ me ].nmigrate += 1;
+		}
+
+		rqunlock2( me, i );
+
+		if ( p )
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Balance the load between CPU me and the others:
+   . processes in me's queue that may no longer run on me
+     (see setaffinity) are moved to a CPU they may run on
+   . if some CPU has at least two more processes than me, one of
+     them is pulled over. Processes otherwise stay on the CPU they
+     last ran on, where their memory may still be in the caches
+   Called by schedtick every BALANCETICKS, and by the scheduler
+   before stealing.
+*/
+static void rqbalance ( int me )
+{
+	struct proc* p;
+	int          i,
+	             busiest,
+	             max;
+
+	for ( ;; )
+	{
+		acquire( &runqs[ me ].lock );
+
+		p = rqtake( &runqs[ me ], mustleave, me );
+
+		release( &runqs[ me ].lock );
+
+		if ( p == 0 )
+		{
+			break;
+		}
+
+		rqmove( p, pickcpu( p ) );
+	}
+
+
+	busiest = - 1;
+	max     = cpuload( me ) + 1;
+
+	for ( i = 0; i < ncpu; i += 1 )
+	{
+		if ( i != me && cpuload( i ) > max )
+		{
+			busiest = i;
+			max     = cpuload( i );
+		}
+	}
+
+	if ( busiest < 0 )
+	{
+		return;
+	}
+
+	rqlock2( me, busiest );
+
+	p = rqtake( &runqs[ busiest ], canrun, me );
+
+	if ( p )
+	{
+		p->cpu = me;
+
+		rqpush( &runqs[ me ], p );
+
+		cpus[ me ].nmigrate += 1;
+	}
+
+	rqunlock2( me, busiest );
+}
+
+
+// Add p to the tail of sq.
+// Caller must hold sq->lock.
+static void sqpush ( struct sleepq* sq, struct proc* p )
+{
+	struct proc** pp;
+
+	for ( pp = &sq->head; *pp; pp = &( *pp )->sqnext )
+	{
+		;
+	}
+
+	p->sqnext = 0;
+
+	*pp = p;
+}
+
+/* Wake up p if it is sleeping, whatever chan it is sleeping on.
+   Used by kill.
+*/
+static void wakeupproc ( struct proc* p )
+{
+	struct sleepq* sq;
+	struct proc**  pp;
+	void*          chan;
+
+	for ( ;; )
+	{
+		chan = p->chan;
+
+		if ( p->state != SLEEPING )
+		{
+			return;
+		}
+
+		sq = SLEEPQ( chan );
+
+		acquire( &sq->lock );
+
+		// Still asleep on the same chan (else woke up meanwhile, recheck)
+		if ( p->state == SLEEPING && p->chan == chan )
+		{
+			for ( pp = &sq->head; *pp != p; pp = &( *pp )->sqnext )
+			{
+				;
+			}
+
+			*pp = p->sqnext;  // unlink
+
+			p->sqnext = 0;
+
+			setrunnable( p );
+
+			release( &sq->lock );
+
+			return;
+		}
+
+		release( &sq->lock );
+	}
+}
+
+
+// _________________________________________________________________________________
+
+// Set up first user process.
+void userinit ( void )
+{
+	// extern char _binary_initcode_start[], _binary_initcode_size[];
+	extern char _binary_img_initcode_start [],
+	            _binary_img_initcode_size  [];  // JK, new path
+
+	struct proc* p;
+	pde_t*       pgdir;
+
+
+	// Allocate an UNUSED process from the process table, and allocate
+	// and initialize its kernel stack
+	p = allocproc();
+
+	initproc = p;
+
+	acquire( &ptable.lock );
+
+	procadd( p, 0 );
+
+	release( &ptable.lock );
+
+
+	// Create a page table for the process
+	// The page table will first only hold mappings for memory used
+	// by the kernel...
+	// initcode's binary is expected to be equal to or less than one page in size
+	if ( ( pgdir = setupkvm() ) == 0 || ( p->vm = vmcreate( pgdir, PGSIZE ) ) == 0 )
+	{
+		panic( "userinit: out of memory?" );
+	}
+
+
+	// Copy initcode's binary into the process's user-space memory
+	inituvm(
+
+		p->vm->pgdir,
+		// _binary_initcode_start,
+		// ( int ) _binary_initcode_size
+		_binary_img_initcode_start,
+		( int ) _binary_img_initcode_size
+	);
+
+
+	/* Write values in the new process's trapframe that make it seem
+	   like the process entered the kernel via an interrupt
+
+	   Set tf->eip to zero so that the process starts executing at user-space
+	   location zero on reti by trapret
+	*/
+	memset( p->tf, 0, sizeof( *p->tf ) );
+
+	p->tf->cs     = ( SEG_UCODE << 3 ) | DPL_USER;
+	p->tf->ds     = ( SEG_UDATA << 3 ) | DPL_USER;
+	p->tf->es     = p->tf->ds;
+	p->tf->ss     = p->tf->ds;
+
+	p->tf->eflags = FL_IF;   // enable hardware interrupts ??
+	p->tf->esp    = PGSIZE;  // the process's largest valid virtual address. Why ??
+	p->tf->eip    = 0;       // beginning (entry point) of initcode.S
+
+
+	// Set process name. For debugging
+	safestrcpy( p->name, "initcode", sizeof( p->name ) );
+
+	// No open files, cwd is the root directory...
+	if ( ( p->files = fdtalloc( namei( "/" ) ) ) == 0 )
+	{
+		panic( "userinit: out of memory?" );
+	}
+
+
+	// This assignment to p->state lets other cores
+	// run this process. The acquire forces the above
+	// writes to be visible, and the lock is also needed
+	// because the assignment might not be atomic.
+	p->cpu = 0;
+
+	setrunnable( p );  // Mark the process as avaialble for scheduling
+}
+
+
+// _________________________________________________________________________________
+
+// Create a new process copying p as the parent.
+// Sets up stack to return as if from system call.
+// Caller must set state of returned proc to RUNNABLE.
+
+// How does a pid of zero (child) get returned ??
+int fork ( void )
+{
+	struct proc* curproc;
+	struct proc* newproc;
+	pde_t*       pgdir;
+	int          pid;
+
+	//
+	curproc = myproc();
+
+	// Allocate process
+	newproc = allocproc();
+
+	if ( newproc == 0 )
+	{
+		return - 1;
+	}
+
+	// Setup its page table as a copy of curproc's
+	// (locked, as other threads may be growing it)
+	vmlock( curproc->vm );
+
+	pgdir = copyuvm( curproc->vm->pgdir, curproc->vm->sz );
+
+	newproc->vm = pgdir ? vmcreate( pgdir, curproc->vm->sz ) : 0;
+
+	vmunlock( curproc->vm );
+
+	// Copy file descriptors
+	newproc->files = newproc->vm ? fdtcopy( curproc->files ) : 0;
+
+	if ( newproc->files == 0 )
+	{
+		if ( newproc->vm )
+		{
+			vmput( newproc->vm );
+		}
+		else if ( pgdir )
+		{
+			freevm( pgdir );
+		}
+
+		kfree( newproc->kstack );
+
+		acquire( &ptable.lock );
+
+		procfree( newproc );
+
+		release( &ptable.lock );
+
+		return - 1;
+	}
+
+	// Use same trapframe as parent
+	/* This also has effect that the child will resume execution at the
+	   same point (tf->eip) as the parent.
+	   This corresponds to the point after the parent's call to fork.
+	*/
+	*( newproc->tf ) = *( curproc->tf );
+
+	// Clear %eax so that fork returns 0 in the child.
+	newproc->tf->eax = 0;
+
+	safestrcpy( newproc->name, curproc->name, sizeof( curproc->name ) );
+
+	pid = newproc->pid;  //
+
+	// Start on the parent's CPU, idle CPUs will steal it if needed
+	newproc->cpu = curproc->cpu;
+
+	newproc->nice     = curproc->nice;
+	newproc->affinity = curproc->affinity;
+
+	acquire( &ptable.lock );
+
+	procadd( newproc, curproc );
+
+	release( &ptable.lock );
+
+	setrunnable( newproc );
+
+	return pid;
+}
+
+/* Create a thread, a new process that shares the current process's
+   address space and open files (and cwd).
+   'stack' is a page aligned page of user memory for the thread's
+   user stack.
+
+   Like fork, clone returns twice. The caller gets the new thread's
+   pid, and the thread gets 0. The thread continues from the same
+   point as the caller, on a copy of the caller's stack page placed
+   at 'stack' (with %esp and %ebp moved along). So it can use the
+   caller's local variables, but must not return from the function
+   that called clone, it should call exit instead.
+
+   Only the page %esp is in gets copied. If the caller's frame
+   straddles a page boundary, or the thread follows %ebp into the
+   frames of functions further up, it sees the caller's stack (not
+   a copy), as %ebp is only moved when it points into that page.
+   So keep what the thread needs in the function that calls clone,
+   and call clone with little on the stack.
+
+   Threads are reaped with join instead of wait.
+*/
+int clone ( char* stack )
+{
+	struct proc* curproc;
+	struct proc* newproc;
+	uint         ustack;
+	uint         esp,
+	             ebp;
+	char*        src;
+	char*        dst;
+	int          pid;
+
+	curproc = myproc();
+
+	esp    = curproc->tf->esp;
+	ebp    = curproc->tf->ebp;
+	ustack = PGROUNDDOWN( esp );  // the caller's stack page
+
+	if ( ( uint ) stack % PGSIZE != 0 || ( uint ) stack + PGSIZE > curproc->vm->sz )
+	{
+		return - 1;
+	}
+
+	/* Threads' memory is never swapped out (see swapbegin), as
+	   swap.c can't keep the other threads off a page it is working
+	   on. Bring back anything already out.
+	*/
+	if ( swapinrange( curproc->vm->pgdir, 0, curproc->vm->sz ) < 0 )
+	{
+		return - 1;
+	}
+
+	/* Both pages must be user memory. Being below sz isn't enough,
+	   for ex. the guard page below the main stack is in range but
+	   not PTE_U. Copy through the kernel's mapping of the pages.
+	*/
+	src = userVAddrToPhysAddr( curproc->vm->pgdir, ( char* ) ustack );
+	dst = userVAddrToPhysAddr( curproc->vm->pgdir, stack );
+
+	if ( src == 0 || dst == 0 )
+	{
+		return - 1;
+	}
+
+	newproc = allocproc();
+
+	if ( newproc == 0 )
+	{
+		return - 1;
+	}
+
+	memmove( dst, src, PGSIZE );
+
+	*( newproc->tf ) = *( curproc->tf );
+
+	newproc->tf->eax = 0;  // clone returns 0 in the thread
+	newproc->tf->esp = ( uint ) stack + ( esp - ustack );
+
+	if ( ebp >= ustack && ebp < ustack + PGSIZE )
+	{
+		newproc->tf->ebp = ( uint ) stack + ( ebp - ustack );
+	}
+
+	newproc->vm       = curproc->vm;
+	newproc->files    = fdtdup( curproc->files );
+	newproc->isthread = 1;
+	newproc->ustack   = stack;
+
+	safestrcpy( newproc->name, curproc->name, sizeof( curproc->name ) );
+
+	pid = newproc->pid;
+
+	newproc->cpu      = curproc->cpu;
+	newproc->nice     = curproc->nice;
+	newproc->affinity = curproc->affinity;
+
+	acquire( &ptable.lock );
+
+	curproc->vm->ref += 1;
+
+	procadd( newproc, curproc );
+
+	release( &ptable.lock );
+
+	setrunnable( newproc );
+
+	return pid;
+}
+
+
+// _________________________________________________________________________________
+
+// Grow current process's memory by n bytes.
+// Return 0 on success, -1 on failure.
+int growproc ( int n )
+{
+	struct proc*    curproc;
+	struct vmspace* vm;
+	uint            sz;
+
+	//
+	curproc = myproc();
+
+	vm = curproc->vm;
+
+	vmlock( vm );  // other threads may be growing it too
+
+	sz = vm->sz;
+
+	// Allocate n pages and add mappings
+	if ( n > 0 )
+	{
+		sz = allocuvm( vm->pgdir, sz, sz + n );
+	}
+
+	// Deallocate abs(n) pages and remove mappings
+	/* Not while there are other threads. They may be using the
+	   memory, on other CPUs with the old mappings still in their
+	   TLBs.
+	*/
+	else if ( n < 0 )
+	{
+		sz = vm->ref > 1 ? 0 : deallocuvm( vm->pgdir, sz, sz + n );
+	}
+
+	if ( sz == 0 )
+	{
+		vmunlock( vm );
+
+		return - 1;
+	}
+
+	vm->sz = sz;
+
+	vmunlock( vm );
+
+	switchuvm( curproc );
+
+	return 0;
+}
+
+
+// _________________________________________________________________________________
+
+// a += b
+static void acctadd ( struct procacct* a, struct procacct* b )
+{
+	a->utime   += b->utime;
+	a->stime   += b->stime;
+	a->nvcsw   += b->nvcsw;
+	a->nivcsw  += b->nivcsw;
+	a->nfault  += b->nfault;
+	a->nswapin += b->nswapin;
+	a->inblock += b->inblock;
+	a->oublock += b->oublock;
+	a->rchar   += b->rchar;
+	a->wchar   += b->wchar;
+}
+
+static void acctcopy ( struct rusage* ru, struct procacct* a )
+{
+	ru->utime   = a->utime;
+	ru->stime   = a->stime;
+	ru->nvcsw   = a->nvcsw;
+	ru->nivcsw  = a->nivcsw;
+	ru->nfault  = a->nfault;
+	ru->nswapin = a->nswapin;
+	ru->inblock = a->inblock;
+	ru->oublock = a->oublock;
+	ru->rchar   = a->rchar;
+	ru->wchar   = a->wchar;
+}
+
+/* Resource usage of the current process (RUSAGE_SELF), or of its
+   children that have been waited for (RUSAGE_CHILDREN).
+   Returns -1 if 'who' is neither.
+*/
+int getrusage ( int who, struct rusage* ru )
+{
+	struct proc* curproc;
+
+	curproc = myproc();
+
+	if ( who == RUSAGE_SELF )
+	{
+		acctcopy( ru, &curproc->acct );
+	}
+	else if ( who == RUSAGE_CHILDREN )
+	{
+		acctcopy( ru, &curproc->cacct );
+	}
+	else
+	{
+		return - 1;
+	}
+
+	return 0;
+}
+
+/* Fill 'info' with (at most 'n' of) the processes in the system,
+   lowest pid first. For ps and top.
+   Returns the number filled in.
+*/
+int getprocs ( struct procinfo* info, int n )
+{
+	static char states [] = {
+
+		[ UNUSED   ] '?',
+		[ EMBRYO   ] 'E',
+		[ SLEEPING ] 'S',
+		[ RUNNABLE ] 'r',
+		[ RUNNING  ] 'R',
+		[ ZOMBIE   ] 'Z'
+	};
+
+	struct proc* p;
+	int          i;
+
+	acquire( &ptable.lock );
+
+	// No locks for the state and counters, it's only a snapshot
+	for ( p = ptable.head, i = 0; p && i < n; p = p->allnext, i += 1 )
+	{
+		info[ i ].pid   = p->pid;
+		info[ i ].ppid  = p->parent ? p->parent->pid : 0;
+		info[ i ].state = states[ p->state ];
+		info[ i ].nice  = p->nice;
+		info[ i ].prio  = p->prio;
+		info[ i ].cpu   = p->cpu;
+		info[ i ].sz    = p->vm ? p->vm->sz : 0;
+
+		safestrcpy( info[ i ].name, p->name, sizeof( info[ i ].name ) );
+
+		acctcopy( &info[ i ].ru, &p->acct );
+	}
+
+	release( &ptable.lock );
+
+	return i;
+}
 
 
 // _________________________________________________________________________________
@@ -464,12 +1572,14 @@ int growproc ( int n )
     . If the parent exits before the child, the init process
       adopts the child and waits for it.
 */
-int wait ( void )
+static int waitchild ( int isthread, char** ustack )
 {
-	struct proc* curproc;
-	struct proc* p;
-	int          havekids,
-	             pid;
+	struct proc*    curproc;
+	struct proc*    p;
+	struct proc**   pp;
+	struct vmspace* vm;
+	int             havekids,
+	                pid;
 
 	//
 	curproc = myproc();
@@ -479,12 +1589,14 @@ int wait ( void )
 
 	for ( ;; )
 	{
-		// Scan through table looking for exited children.
+		// Scan through our children looking for exited ones.
 		havekids = 0;
 
-		for ( p = ptable.proc; p < &ptable.proc[ NPROC ]; p += 1 )
+		for ( pp = &curproc->children; ( p = *pp ) != 0; pp = &p->sibling )
 		{
-			if ( p->parent != curproc )
+			// wait is for processes, join for threads. Except
+			// init, which adopts orphans of both kinds (see exit)
+			if ( p->isthread != isthread && curproc != initproc )
 			{
 				continue;
 			}
@@ -496,24 +1608,40 @@ int wait ( void )
 			{
 				pid = p->pid;
 
+				/* The child sets ZOMBIE while holding its CPU's run
+				   queue lock, and holds it until it has switched
+				   away for good (see exit). Wait for that, it's
+				   still using its stack and page table until then.
+				*/
+				acquire( &runqs[ p->cpu ].lock );
+				release( &runqs[ p->cpu ].lock );
+
 				// Free associated memory
-				/* The parent frees p->kstack and p->pgdir because the
+				/* The parent frees p->kstack and p->vm because the
 				   child uses them one last time when running 'exit'
 				*/
 				kfree( p->kstack );
 
-				freevm( p->pgdir );
+				vm = p->vm;
+
+				if ( ustack )
+				{
+					*ustack = p->ustack;
+				}
+
+				*pp = p->sibling;  // unlink from our children
+
+				pidremove( p );
 
-				// Prepare the "struct proc" for reuse
-				p->kstack    = 0;
-				p->pid       = 0;
-				p->parent    = 0;
-				p->name[ 0 ] = 0;
-				p->killed    = 0;
-				p->state     = UNUSED;
+				acctadd( &curproc->cacct, &p->acct );
+				acctadd( &curproc->cacct, &p->cacct );
+
+				procfree( p );
 
 				release( &ptable.lock );
 
+				vmput( vm );  // the page table goes with the last thread
+
 				return pid;
 			}
 		}
@@ -526,11 +1654,26 @@ int wait ( void )
 			return - 1;
 		}
 
-		// Wait for children to exit. See wakeup1 call in exit.
+		// Wait for children to exit. See wakeup call in exit.
 		sleep( curproc, &ptable.lock );
 	}
 }
 
+int wait ( void )
+{
+	return waitchild( 0, 0 );
+}
+
+/* Wait for a child thread (see clone) to exit and return its pid.
+   If 'ustack' is not 0, the stack that was passed to clone is
+   stored there, so that the caller can free it.
+   Return -1 if this process has no child threads.
+*/
+int join ( char** ustack )
+{
+	return waitchild( 1, ustack );
+}
+
 // Exit the current process. Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -538,7 +1681,6 @@ void exit ( void )
 {
 	struct proc* curproc;
 	struct proc* p;
-	int          fd;
 
 	//
 	curproc = myproc();
@@ -549,54 +1691,151 @@ void exit ( void )
 		panic( "exit: init exiting" );
 	}
 
-	// Close all open files.
-	for ( fd = 0; fd < NOPENFILE_PROC; fd += 1 )
-	{
-		if ( curproc->ofile[ fd ] )
-		{
-			fileclose( curproc->ofile[ fd ] );
-
-			curproc->ofile[ fd ] = 0;
-		}
-	}
-
-	// ??
-	begin_op();
+	// Close all open files (unless other threads still use them)
+	fdtput( curproc->files );
 
-	iput( curproc->cwd );
+	curproc->files = 0;
 
-	end_op();
-
-	curproc->cwd = 0;
+	// Destroy the shared memory segments we created but never attached
+	shmexit( curproc->pid );
 
 
 	acquire( &ptable.lock );
 
 	// Wakeup parent. They might be sleeping in wait()
-	wakeup1( curproc->parent );
+	wakeup( curproc->parent );
 
 	// Pass abandoned children to init.
-	for ( p = ptable.proc; p < &ptable.proc[ NPROC ]; p += 1 )
+	if ( curproc->children )
 	{
-		if ( p->parent == curproc )
+		for ( p = curproc->children; ; p = p->sibling )
 		{
 			p->parent = initproc;
 
 			if ( p->state == ZOMBIE )
 			{
-				wakeup1( initproc );
+				wakeup( initproc );
+			}
+
+			if ( p->sibling == 0 )
+			{
+				break;
 			}
 		}
+
+		// p is the last child, put the list in front of init's
+		p->sibling         = initproc->children;
+		initproc->children = curproc->children;
+		curproc->children  = 0;
 	}
 
 	// Jump into the scheduler, never to return.
+	acquire( &runqs[ curproc->cpu ].lock );
+
 	curproc->state = ZOMBIE;
 
+	release( &ptable.lock );
+
 	sched();
 
 	panic( "exit: zombie exit" );
 }
 
+/* Set the base priority level of process 'pid' (see "Priorities"
+   at the top of this file). Larger is lower priority.
+   It takes effect the next time the process is queued.
+   Returns -1 if there is no such process.
+*/
+int setpriority ( int pid, int nice )
+{
+	struct proc* p;
+
+	if ( nice < 0 )
+	{
+		nice = 0;
+	}
+	else if ( nice > NPRIO - 1 )
+	{
+		nice = NPRIO - 1;
+	}
+
+	acquire( &ptable.lock );
+
+	p = pidlookup( pid );
+
+	if ( p == 0 )
+	{
+		release( &ptable.lock );
+
+		return - 1;
+	}
+
+	p->nice    = nice;
+	p->boosted = - 1;  // rqpush sets p->prio from p->nice
+
+	release( &ptable.lock );
+
+	return 0;
+}
+
+/* Restrict process 'pid' to the CPUs in 'mask' (bit i for CPU i).
+   A process that is queued or running elsewhere moves the next time
+   it is woken up or its CPU balances (see rqbalance).
+   Returns -1 if there is no such process, or no CPU in mask.
+*/
+int setaffinity ( int pid, uint mask )
+{
+	struct proc* p;
+
+	mask &= ( 1 << ncpu ) - 1;
+
+	if ( mask == 0 )
+	{
+		return - 1;
+	}
+
+	acquire( &ptable.lock );
+
+	p = pidlookup( pid );
+
+	if ( p == 0 )
+	{
+		release( &ptable.lock );
+
+		return - 1;
+	}
+
+	p->affinity = mask;
+
+	release( &ptable.lock );
+
+	return 0;
+}
+
+/* Return the CPUs process 'pid' may run on, as a mask.
+   Returns 0 if there is no such process.
+*/
+uint getaffinity ( int pid )
+{
+	struct proc* p;
+	uint         mask;
+
+	mask = 0;
+
+	acquire( &ptable.lock );
+
+	p = pidlookup( pid );
+
+	if ( p != 0 )
+	{
+		mask = p->affinity & ( ( 1 << ncpu ) - 1 );
+	}
+
+	release( &ptable.lock );
+
+	return mask;
+}
+
 // Kill the process with the given pid
 /* Lets one process request that another be terminated.
 
@@ -606,43 +1845,94 @@ void exit ( void )
    (ex. via system call, timer interrupt), at which point
    code in trap will call exit if p->killed is set.
 */
-int kill ( int pid )
+int kill ( int pid )
+{
+	struct proc* p;
+
+	acquire( &ptable.lock );
+
+	p = pidlookup( pid );
+
+	if ( p == 0 )
+	{
+		release( &ptable.lock );
+
+		return - 1;
+	}
+
+	p->killed = 1;
+
+	// Wake process from sleep if necessary
+	/* Potenially dangerous because the condition the
+	   process is waiting on might not be true. However,
+	   xv6 convention is to wrap sleep calls in a while-loop
+	   that retests the condition after sleep returns.
+	   Some calls to sleep test p->killed to abandon early.
+	*/
+	wakeupproc( p );
+
+	release( &ptable.lock );
+
+	return 0;
+}
+
+
+// _________________________________________________________________________________
+
+/* Halt until an interrupt arrives, unless there is work to do.
+   Called by the scheduler with interrupts enabled and no locks held.
+*/
+static void cpuidle ( struct cpu* c, int id )
 {
-	struct proc* p;
+	uint start;
+	int  i;
 
-	acquire( &ptable.lock );
+	cli();
+
+	/* Let cpukick know we need an IPI.
+	   xchg is also a memory barrier, so that the check below can't
+	   read the queues before other CPUs see c->idle set. Either
+	   they see it and send an IPI, or we see their process.
+	*/
+	xchg( &c->idle, 1 );
 
-	for ( p = ptable.proc; p < &ptable.proc[ NPROC ]; p += 1 )
+	for ( i = 0; i < ncpu; i += 1 )
 	{
-		if ( p->pid == pid )
+		if ( i == id ? runqs[ i ].n > 0 : rqhaswork( &runqs[ i ], id ) )
 		{
-			p->killed = 1;
-
-			// Wake process from sleep if necessary
-			/* Potenially dangerous because the condition the
-			   process is waiting on might not be true. However,
-			   xv6 convention is to wrap sleep calls in a while-loop
-			   that retests the condition after sleep returns.
-			   Some calls to sleep test p->killed to abandon early.
-			*/
-			if ( p->state == SLEEPING )
-			{
-				p->state = RUNNABLE;
-			}
+			c->idle = 0;
 
-			release( &ptable.lock );
+			sti();
 
-			return 0;
+			return;
 		}
 	}
 
-	release( &ptable.lock );
+	// Only CPU 0's tick is needed (timekeeping, timer.c)
+	if ( id != 0 )
+	{
+		lapictimer( 0 );
+	}
 
-	return - 1;
-}
+	c->nhalt += 1;
 
+	start = ticks;
 
-// _________________________________________________________________________________
+	stihlt();
+
+	// - - - - - - - - - - - - - - - - -
+	// An interrupt woke us up, a wakeup IPI or a device
+
+	c->idletime += ticks - start;
+
+
+	if ( id != 0 )
+	{
+		lapictimer( 1 );
+	}
+
+	c->idle = 0;
+}
 
 // Per-CPU process scheduler.
 /* Each CPU calls scheduler() after setting itself up.
@@ -662,14 +1952,17 @@ int kill ( int pid )
    restoring the new thread's registers (including %eip and %esp
    which specify what code is executing and which stack is used)
 
-   The scheduler releases ptable.lock and explicitly enables
+   The scheduler releases its run queue lock and explicitly enables
    interrupts once in each iteration of its outer loop.
    This is important for the case where there are multiple
    CPUs and one is idle (it has no RUNNABLE processes).
-   If ptable.lock was continuously held, other CPUs cannot perform
-   context switches as they cannot acquire ptable.lock.
-   They also cannot mark a process as RUNNABLE so as to break the
-   idling CPU out of its scheduling loop...
+   If the lock was continuously held, other CPUs could not
+   put processes on the idle CPU's queue (wakeup), so as to break
+   the idling CPU out of its scheduling loop...
+
+   Picking a process is O(1): it is the head of this CPU's run
+   queue (see "Run queues" at the top of the file). If the queue
+   is empty, the CPU tries to steal a process from another CPU.
    Interrupts are periodically enabled because on an idling CPU,
    perharps some of the processes are actually waiting for IO (lapic...)
 
@@ -680,32 +1973,34 @@ void scheduler ( void )
 {
 	struct proc* p;
 	struct cpu*  c;
+	struct runq* rq;
+	int          id;
 
 	//
-	c = mycpu();
+	c  = mycpu();
+	id = cpuid();
 
 	c->proc = 0;
 
+	rq = &runqs[ id ];
+
 	//
 	for ( ;; )
 	{
 		// Enable interrupts on this processor.
 		sti();
 
-		// Acquire process table lock
-		acquire( &ptable.lock );
+		// Acquire this CPU's run queue lock
+		acquire( &rq->lock );
 
-		// Loop over process table looking for process to run.
-		for ( p = ptable.proc; p < &ptable.proc[ NPROC ]; p += 1 )
+		/* Run processes from the queue until it is empty.
+		   Each process switches back to us holding rq->lock,
+		   so we go straight on to the next one.
+		*/
+		while ( ( p = rqnext( rq ) ) != 0 )
 		{
-			if ( p->state != RUNNABLE )
-			{
-				continue;
-			}
-
-
 			/* Switch to chosen process. It is the process's job
-			   to release ptable.lock and then reacquire it
+			   to release rq->lock and then reacquire it
 			   before jumping back to us.
 			*/
 			c->proc = p;
@@ -716,6 +2011,8 @@ void scheduler ( void )
 			// Switch to the process's page table...
 			switchuvm( p );
 
+			c->nswtch += 1;
+
 			p->state = RUNNING;
 
 			/* Context switch into the process's kernel thread...
@@ -741,21 +2038,156 @@ void scheduler ( void )
 			     swtch( &p->context, mycpu()->scheduler )
 			*/
 
-			// Switch to the kernel-only page table...
-			switchkvm();
+			/* Stay on the process's page table. The next process
+			   picked in this loop will switch straight to its own.
+			*/
 
 			// Process is done running for now.
 			// It should have changed its p->state before coming back.
 			c->proc = 0;
 		}
 
-		// Release process table lock
-		release( &ptable.lock );
+		/* Switch to the kernel-only page table before releasing
+		   rq->lock.
+		   Once the lock is released, the process whose page table
+		   is loaded can run on a different CPU (or be reaped by its
+		   parent) and free that page table, ex. through exec or wait.
+		   While rq->lock is held that can't happen (see wait).
+		*/
+		if ( c->pgdir )
+		{
+			switchkvm();
+
+			c->pgdir  = 0;
+			c->ncr3  += 1;
+		}
+
+		// Release run queue lock
+		release( &rq->lock );
+
+		// Nothing to run, take work from another CPU's queue
+		rqbalance( id );
+
+		if ( runqs[ id ].n > 0 || rqsteal( id ) )
+		{
+			continue;
+		}
+
+		// Still nothing to run, do some background work
+		if ( kzrefill() )  // zero a page ahead of time
+		{
+			continue;
+		}
+
+		// Nothing at all to do
+		cpuidle( c, id );
+	}
+}
+
+/* Pick a process whose memory swap.c can reclaim, starting the
+   search at the first process whose pid is at least *pid (the list
+   is in pid order). Sets *pid to the picked process's pid (or 0 if
+   there is none).
+
+   A process qualifies if the kernel can't be using its user memory
+   behind swap.c's back:
+     . it is not running on any CPU (RUNNABLE or SLEEPING), or is the
+       current process (which is the one asking)
+     . it is not in the middle of a system call (see insyscall),
+       unless it is the current process and the system call said
+       its memory isn't in use (see reclaimself)
+     . it doesn't share its memory with other threads (see clone)
+
+   The process is marked swapbusy so that the scheduler doesn't run
+   it while swap.c is changing its page table. Call swapend when done.
+   The current process is not marked, as it has to keep running
+   (ex. after sleeping on the disk write).
+*/
+struct proc* swapbegin ( int* pid )
+{
+	struct proc* curproc;
+	struct proc* p;
+	struct runq* rq;
+	int          ok;
+
+	curproc = myproc();
+
+	acquire( &ptable.lock );
+
+	for ( p = ptable.head; p; p = p->allnext )
+	{
+		if ( p->pid < *pid || p->state == EMBRYO )
+		{
+			continue;
+		}
+
+		if ( p->swapbusy )
+		{
+			continue;
+		}
+
+		if ( p->insyscall && ! ( p == curproc && p->reclaimself ) )
+		{
+			continue;
+		}
+
+		// Threads, see clone
+		if ( p->vm == 0 || p->vm->ref > 1 )
+		{
+			continue;
+		}
+
+		if ( p == curproc )
+		{
+			ok = 1;
+		}
+		else
+		{
+			// The state can only be trusted while holding the queue
+			// lock of p's CPU (which can change until we hold it)
+			rq = &runqs[ p->cpu ];
+
+			acquire( &rq->lock );
+
+			ok = rq == &runqs[ p->cpu ] && ( p->state == RUNNABLE || p->state == SLEEPING );
+
+			if ( ok )
+			{
+				p->swapbusy = 1;
+			}
+
+			release( &rq->lock );
+		}
+
+		if ( ok )
+		{
+			*pid = p->pid;
+
+			release( &ptable.lock );
+
+			return p;
+		}
 	}
+
+	*pid = 0;
+
+	release( &ptable.lock );
+
+	return 0;
+}
+
+void swapend ( struct proc* p )
+{
+	acquire( &ptable.lock );
+
+	p->swapbusy = 0;
+
+	release( &ptable.lock );
 }
 
 // Enter scheduler.
-/* Must hold only ptable.lock and have changed proc->state.
+/* Must hold only the run queue lock of the CPU (runqs[ p->cpu ].lock)
+   and have changed proc->state.
    Saves and restores intena because intena is a property of this
    kernel thread, not this CPU.
    It should be proc->intena and proc->ncli, but that would
@@ -773,14 +2205,14 @@ void sched ( void )
 
 	p = myproc();
 
-	if ( ! holding( &ptable.lock ) )
+	if ( ! holding( &runqs[ p->cpu ].lock ) )
 	{
-		panic( "sched: ptable.lock not held" );
+		panic( "sched: runq lock not held" );
 	}
 
 	if ( mycpu()->ncli != 1 )
 	{
-		// Only ptable.lock should be held ??
+		// Only the run queue lock should be held ??
 		panic( "sched: number of locks" );
 	}
 
@@ -796,6 +2228,15 @@ void sched ( void )
 	}
 
 
+	if ( p->state == RUNNABLE )
+	{
+		p->acct.nivcsw += 1;  // yield
+	}
+	else if ( p->state == SLEEPING )
+	{
+		p->acct.nvcsw += 1;
+	}
+
 	// Save the process's interrupt enable state
 	intena = mycpu()->intena;
 
@@ -826,7 +2267,7 @@ void sched ( void )
    will 'swtch' here.
    And then "return" to user-space via trapret.
 */
-/* forkret exists to release the ptable.lock held
+/* forkret exists to release the run queue lock held
    by the scheduler. Otherwise, the new process could
    start at trapret
 */
@@ -834,8 +2275,8 @@ void forkret ( void )
 {
 	static int first = 1;
 
-	// Still holding ptable.lock from scheduler.
-	release( &ptable.lock );
+	// Still holding run queue lock from scheduler.
+	release( &runqs[ myproc()->cpu ].lock );
 
 	if ( first )
 	{
@@ -846,6 +2287,7 @@ void forkret ( void )
 
 		iinit( ROOTDEV );    // ...
 		initlog( ROOTDEV );  // initialize log. Recover file system if necessary
+		swapinit( ROOTDEV ); // swap area (after file system, uses its superblock)
 	}
 
 	// Return to "caller", actually trapret (see allocproc).
@@ -854,16 +2296,105 @@ void forkret ( void )
 
 // _________________________________________________________________________________
 
+/* Account a clock tick to the running process (if any) and CPU,
+   as user time if the tick interrupted user code ('user' set),
+   kernel time otherwise.
+   Called by trap on every timer interrupt, with interrupts disabled.
+*/
+void accttick ( int user )
+{
+	struct proc* p;
+	struct cpu*  c;
+
+	p = myproc();
+	c = mycpu();
+
+	if ( p == 0 )
+	{
+		return;
+	}
+
+	if ( user )
+	{
+		p->acct.utime += 1;
+		c->utime      += 1;
+	}
+	else
+	{
+		p->acct.stime += 1;
+		c->stime      += 1;
+	}
+}
+
+/* Charge the running process for a clock tick.
+   Returns 1 if it should give up the CPU, because it has used up its
+   quantum (and is moved down a level) or because a process of higher
+   priority is waiting.
+   Called by trap on every timer interrupt, with interrupts disabled.
+*/
+int schedtick ( void )
+{
+	struct proc* p;
+	struct cpu*  c;
+	struct runq* rq;
+	int          prio;
+
+	p = myproc();
+	c = mycpu();
+
+	c->ntick += 1;
+
+	if ( c->ntick % BALANCETICKS == 0 )
+	{
+		rqbalance( p->cpu );
+	}
+
+	p->quantum += 1;
+
+	if ( p->quantum >= QUANTUM( p->prio ) )
+	{
+		if ( p->prio < NPRIO - 1 )
+		{
+			p->prio += 1;
+		}
+
+		p->quantum = 0;
+
+		return 1;
+	}
+
+	// Unlocked peek, worst case we yield a tick late (or early)
+	rq = &runqs[ p->cpu ];
+
+	for ( prio = 0; prio < p->prio; prio += 1 )
+	{
+		if ( rq->head[ prio ] )
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
 // Give up the CPU for one scheduling round.
 void yield ( void )
 {
-	acquire( &ptable.lock );
+	struct proc* p;
+
+	p = myproc();
+
+	// p->cpu is the CPU we are running on, and can't change while running
+	acquire( &runqs[ p->cpu ].lock );
 
-	myproc()->state = RUNNABLE;
+	p->state = RUNNABLE;
+
+	rqpush( &runqs[ p->cpu ], p );
 
 	sched();
 
-	release( &ptable.lock );
+	// May be on a different CPU now (see rqsteal)
+	release( &runqs[ p->cpu ].lock );
 }
 
 
@@ -897,7 +2428,7 @@ void yield ( void )
 
    We need sleep to atomically release the lock and put
    the process to sleep... ??
-   By holding ptable.lock, we ensure atomicity because fkdslfdf
+   By holding the sleep queue's lock, we ensure atomicity because fkdslfdf
 
    p.69 ...
 */
@@ -927,7 +2458,8 @@ void yield ( void )
 */
 void sleep ( void* chan, struct spinlock* lk )
 {
-	struct proc* p;
+	struct proc*   p;
+	struct sleepq* sq;
 
 	p = myproc();
 
@@ -941,68 +2473,213 @@ void sleep ( void* chan, struct spinlock* lk )
 		panic( "sleep: without lk" );
 	}
 
-	/* Must acquire ptable.lock in order to change p->state
-	   and then call sched.
+	/* Must acquire the sleep queue's lock in order to add
+	   ourselves to it and change p->state.
 
-	   Once we hold ptable.lock, we can be guaranteed that we won't
-	   miss any wakeup since wakeup runs with ptable.lock locked.
+	   Once we hold sq->lock, we can be guaranteed that we won't
+	   miss any wakeup since wakeup runs with sq->lock locked.
 	   It is now safe to release lk... p.69
 	*/
-	if ( lk != &ptable.lock )
+	sq = SLEEPQ( chan );
+
+	acquire( &sq->lock );
+
+	release( lk );
+
+	// Our timer went off before we got here (see sleeptimeout)
+	if ( p->timedout )
 	{
-		acquire( &ptable.lock );
+		release( &sq->lock );
+
+		acquire( lk );
 
-		release( lk );
+		return;
 	}
 
 	// Go to sleep.
+	/* Hold on to the run queue lock until we have switched away,
+	   so that a wakeup can't put us on a run queue (where another
+	   CPU could pick us up) before then. See setrunnable.
+	*/
+	acquire( &runqs[ p->cpu ].lock );
+
 	p->chan  = chan;
 	p->state = SLEEPING;
 
+	sqpush( sq, p );
+
+	release( &sq->lock );
+
 	sched();
 
 
 	// - - - - - - - - - - - - - - - - -
 	// Continues from here after wakeup
+	// (whoever woke us took us off the sleep queue)
+
 
+	release( &runqs[ p->cpu ].lock );
 
 	// Tidy up.
 	p->chan = 0;
 
 	// Reacquire original lock.
-	if ( lk != &ptable.lock )
+	acquire( lk );
+}
+
+struct sleeptimer
+{
+	struct proc* p;
+	void*        chan;
+};
+
+/* Timer callback for sleeptimeout.
+   Marks the process as timed out and wakes it up if it's asleep.
+   Both happen under the sleep queue's lock, which is also held by
+   sleep when it checks p->timedout, so a timer that goes off just
+   before the process goes to sleep isn't missed.
+*/
+static void sleepexpire ( void* arg )
+{
+	struct sleeptimer* st;
+	struct sleepq*     sq;
+	struct proc**      pp;
+	struct proc*       p;
+
+	st = arg;
+	p  = st->p;
+	sq = SLEEPQ( st->chan );
+
+	acquire( &sq->lock );
+
+	p->timedout = 1;
+
+	if ( p->state == SLEEPING && p->chan == st->chan )
 	{
-		release( &ptable.lock );
+		for ( pp = &sq->head; *pp != p; pp = &( *pp )->sqnext )
+		{
+			;
+		}
 
-		acquire( lk );
+		*pp = p->sqnext;  // unlink
+
+		p->sqnext = 0;
+
+		setrunnable( p );
 	}
+
+	release( &sq->lock );
 }
 
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
-/* Causes the processes's sleep calls to return.
+/* Like sleep, but gives up after 'nticks' clock ticks.
+   Returns -1 if it timed out, 0 if woken up before that.
+   Like sleep, the caller should recheck its condition either way.
 */
-static void wakeup1 ( void* chan )
+int sleeptimeout ( void* chan, struct spinlock* lk, uint nticks )
 {
-	struct proc* p;
+	struct proc*      p;
+	struct timer      t;
+	struct sleeptimer st;
+	int               r;
+
+	p = myproc();
+
+	st.p    = p;
+	st.chan = chan;
+
+	t.pending = 0;
 
-	for ( p = ptable.proc; p < &ptable.proc[ NPROC ]; p += 1 )
+	timeradd( &t, nticks, sleepexpire, &st );
+
+	sleep( chan, lk );
+
+	// Make sure the callback is done with 'st' before we return
+	timerdel( &t );
+
+	r = p->timedout ? - 1 : 0;
+
+	p->timedout = 0;
+
+	return r;
+}
+
+/* Wake up processes sleeping on chan, all of them or just
+   the first 'n' (oldest sleepers first) if 'n' is not 0.
+   Causes the processes's sleep calls to return.
+   Returns the number of processes woken up.
+*/
+static int wakeupsq ( void* chan, int n )
+{
+	struct sleepq* sq;
+	struct proc**  pp;
+	struct proc*   p;
+	int            nwoken;
+
+	sq = SLEEPQ( chan );
+
+	nwoken = 0;
+
+	acquire( &sq->lock );
+
+	pp = &sq->head;
+
+	while ( *pp )
 	{
-		if ( p->state == SLEEPING && p->chan == chan )
+		p = *pp;
+
+		// Different chan that hashes to the same queue
+		if ( p->chan != chan )
 		{
-			p->state = RUNNABLE;
+			pp = &p->sqnext;
+
+			continue;
+		}
+
+		*pp = p->sqnext;  // unlink
+
+		p->sqnext = 0;
+
+		setrunnable( p );
+
+		nwoken += 1;
+
+		if ( nwoken == n )
+		{
+			break;
 		}
 	}
+
+	release( &sq->lock );
+
+	return nwoken;
 }
 
 // Wake up all processes sleeping on chan ("thundering herd")
 void wakeup ( void* chan )
 {
-	acquire( &ptable.lock );
+	wakeupsq( chan, 0 );
+}
+
+/* Wake up one process sleeping on chan.
+   Only for channels where every sleeper waits for the same thing,
+   and the woken process will "use up" the event or pass it on.
+   For ex. sleeplocks: only one waiter can get the lock, so waking
+   all of them just has all but one go straight back to sleep.
+*/
+void wakeupone ( void* chan )
+{
+	wakeupsq( chan, 1 );
+}
 
-	wakeup1( chan );
+// Wake up at most n processes sleeping on chan (see futex.c)
+int wakeupn ( void* chan, int n )
+{
+	if ( n <= 0 )
+	{
+		return 0;
+	}
 
-	release( &ptable.lock );
+	return wakeupsq( chan, n );
 }
 
 
@@ -1031,16 +2708,11 @@ void procdump ( void )
 	uint         pcs [ PROCNPCS ];
 
 	cprintf( "\nprocdump:\n" );
-	cprintf( "pid | state | name\n" );
-	cprintf( "------------------\n\n" );
+	cprintf( "pid | state | prio | name\n" );
+	cprintf( "-------------------------\n\n" );
 
-	for ( p = ptable.proc; p < &ptable.proc[ NPROC ]; p += 1 )
+	for ( p = ptable.head; p; p = p->allnext )
 	{
-		if ( p->state == UNUSED )
-		{
-			continue;
-		}
-
 		if ( p->state >= 0 && p->state < NELEM( states ) && states[ p->state ] )
 		{
 			state = states[ p->state ];
@@ -1050,7 +2722,7 @@ void procdump ( void )
 			state = "???";
 		}
 
-		cprintf( "%d | %s | %s\n", p->pid, state, p->name );
+		cprintf( "%d | %s | %d | %s\n", p->pid, state, p->prio, p->name );
 
 		if ( p->state == SLEEPING )
 		{
@@ -1072,5 +2744,17 @@ void procdump ( void )
 		}
 	}
 
+	cprintf( "\ncpu | switches | cr3 loads | runq | halts | migrations in | user | sys | idle\n" );
+	cprintf( "------------------------------------------------------------------------\n\n" );
+
+	for ( i = 0; i < ncpu; i += 1 )
+	{
+		cprintf( "%d | %d | %d | %d | %d | %d | %d | %d | %d\n",
+
+			i, cpus[ i ].nswtch, cpus[ i ].ncr3, runqs[ i ].n, cpus[ i ].nhalt, cpus[ i ].nmigrate,
+			cpus[ i ].utime, cpus[ i ].stime, cpus[ i ].idletime
+		);
+	}
+
 	cprintf( "\n" );
 }
@@ -9,6 +9,17 @@ struct cpu
 	int               ncli;           // Depth of pushcli nesting.
 	int               intena;         // Were interrupts enabled before pushcli?
 	struct proc*      proc;           // The process currently running on this cpu or null
+
+	pde_t*            pgdir;          // User page table loaded in %cr3, or null if kpgdir (see scheduler)
+	uint              nswtch;         // Number of processes switched to by the scheduler
+	uint              ncr3;           // Number of %cr3 loads by switchuvm and scheduler
+	volatile uint     idle;           // Halted waiting for work (see cpuidle in proc.c)
+	uint              nhalt;          // Number of times the CPU halted
+	uint              nmigrate;       // Number of processes moved to this CPU (see rqbalance)
+	uint              ntick;          // Timer interrupts while running a process (see schedtick)
+	uint              utime;          // Ticks spent running user code (see accttick)
+	uint              stime;          // Ticks spent running a process in the kernel
+	uint              idletime;       // Ticks spent halted (see cpuidle)
 };
 
 extern struct cpu cpus [ NCPU ];
@@ -48,11 +59,37 @@ enum procstate
 	ZOMBIE
 };
 
+// User address space, shared by the threads of a process (see clone in proc.c)
+struct vmspace
+{
+	pde_t*            pgdir;                     // Page table
+	uint              sz;                        // Size of process memory (bytes)
+	int               ref;                       // Number of processes using it (protected by ptable.lock)
+	int               busy;                      // A thread is changing the page table (see vmlock)
+};
+
+/* Resource usage of a process. Each counter is only updated by the
+   process itself, or by the CPU running it, so no locks are needed.
+   Handed to user programs as a struct rusage (see rusage.h).
+*/
+struct procacct
+{
+	uint              utime;                     // Ticks in user mode
+	uint              stime;                     // Ticks in the kernel
+	uint              nvcsw;                     // Voluntary context switches (see sched)
+	uint              nivcsw;                    // Involuntary context switches
+	uint              nfault;                    // Page faults
+	uint              nswapin;                   // Page faults that read a page from swap
+	uint              inblock;                   // Disk blocks read (see bread)
+	uint              oublock;                   // Disk blocks written (see bwrite)
+	uint              rchar;                     // Bytes read (see fileread)
+	uint              wchar;                     // Bytes written (see filewrite)
+};
+
 // Per-process state
 struct proc
 {
-	uint              sz;                        // Size of process memory (bytes)
-	pde_t*            pgdir;                     // Page table
+	struct vmspace*   vm;                        // Address space
 	char*             kstack;                    // Bottom of kernel stack for this process
 	enum procstate    state;                     // Process state
 	int               pid;                       // Process ID
@@ -61,9 +98,29 @@ struct proc
 	struct context*   context;                   // swtch() here to run process
 	void*             chan;                      // If non-zero, sleeping on chan
 	int               killed;                    // If non-zero, have been killed
-	struct file*      ofile [ NOPENFILE_PROC ];  // Open files
-	struct inode*     cwd;                       // Current directory
+	struct fdtable*   files;                     // Open files and current directory
 	char              name [ 16 ];               // Process name (debugging)
+	int               insyscall;                 // If non-zero, kernel may be using the process's user memory (see swap.c)
+	int               reclaimself;               // If non-zero, the process's own reclaims may swap out its memory despite insyscall (see sbrk)
+	int               swapbusy;                  // If non-zero, swap.c is reclaiming the process's memory. Don't run it
+	int               cpu;                       // CPU whose run queue the process is on, or is running on (see proc.c)
+	struct proc*      rqnext;                    // Next process in run queue
+	struct proc*      sqnext;                    // Next process in sleep queue (while SLEEPING)
+	int               timedout;                  // Set by the timer of sleeptimeout
+	int               nice;                      // Base priority level, 0 is highest (see proc.c)
+	int               prio;                      // Current priority level
+	int               quantum;                   // Ticks run at the current level
+	uint              boosted;                   // Last priority boost seen (see rqpush)
+	uint              affinity;                  // CPUs the process may run on, bit i for CPU i
+	int               isthread;                  // Created by clone, shares its parent's vm and files
+	char*             ustack;                    // User stack passed to clone (returned by join)
+	struct proc*      pidnext;                   // Next process in pid hash chain
+	struct proc*      children;                  // First child (see wait)
+	struct proc*      sibling;                   // Next child of the same parent
+	struct proc*      allnext;                   // Next in the list of all processes (see ptable)
+	struct proc*      allprev;                   // Previous in the list of all processes
+	struct procacct   acct;                      // Resource usage
+	struct procacct   cacct;                     // Resource usage of waited for children
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,274 @@
+// Sampling profiler
+
+/* Every 'interval' clock ticks, each CPU records where it was
+   interrupted (a "sample"): the eip, and the return addresses of
+   the callers found by following the %ebp chain. This works for
+   user code as well as the kernel, as both keep frame pointers
+   (-fno-omit-frame-pointer).
+
+   Samples go into a ring buffer per CPU, so CPUs don't contend
+   with each other. When a buffer is full, new samples are dropped
+   (and counted) until a reader makes room.
+
+   User programs control the profiler through /dev/prof:
+     . ioctl( fd, PROF_IOCTL_START, interval ) clears the buffers
+       and starts sampling
+     . read returns whole struct profsamples, oldest first. It
+       doesn't block, 0 means there are none right now
+     . ioctl( fd, PROF_IOCTL_STOP ) stops sampling and returns the
+       number of samples dropped
+   See prof.c in the user programs, which runs a command under the
+   profiler, and tools/profsym.py, which turns the samples into
+   function names.
+
+   CPUs other than 0 don't take timer interrupts while halted (see
+   cpuidle in proc.c), so their idle time doesn't show up.
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "date.h"
+#include "fs.h"
+#include "file.h"
+#include "prof.h"
+
+
+#define NPROFSAMPLE  128  // per CPU
+
+
+struct profbuf
+{
+	struct spinlock   lock;   // Held when using the ring
+	uint              head;   // oldest sample
+	uint              n;      // number of samples in the ring
+	uint              nlost;  // samples dropped because the ring was full
+	uint              ntick;  // ticks since the last sample (only this CPU uses it)
+
+	struct profsample samples [ NPROFSAMPLE ];
+};
+
+static struct profbuf profbufs [ NCPU ];
+
+static volatile int profinterval;  // 0 when not sampling
+
+
+static int profread  ( struct inode*, char*, int );
+static int profioctl ( struct inode*, int, ... );
+
+
+void profinit ( void )
+{
+	int i;
+
+	for ( i = 0; i < NCPU; i += 1 )
+	{
+		initlock( &profbufs[ i ].lock, "prof" );
+	}
+
+	devsw[ PROF ].read  = profread;
+	devsw[ PROF ].write = 0;
+	devsw[ PROF ].ioctl = profioctl;
+}
+
+
+// _________________________________________________________________________________
+
+/* Follow the %ebp chain of user code, starting at 'ebp'.
+   We are in an interrupt and can't fault, so each frame is read
+   through the page table, and the walk stops at the first frame
+   that isn't mapped (or doesn't look like a frame).
+*/
+static void userpcs ( struct proc* p, uint ebp, uint pcs [], int depth )
+{
+	uint* frame;
+	char* page;
+	int   i;
+
+	for ( i = 0; i < depth; i += 1 )
+	{
+		if ( ebp == 0 || ebp % 4 != 0 || ebp >= p->vm->sz || ebp % PGSIZE > PGSIZE - 8 )
+		{
+			break;
+		}
+
+		page = userVAddrToPhysAddr( p->vm->pgdir, ( char* ) ebp );
+
+		if ( page == 0 )
+		{
+			break;
+		}
+
+		frame = ( uint* ) ( page + ebp % PGSIZE );
+
+		pcs[ i ] = frame[ 1 ];  // return address
+
+		// Callers' frames are higher up the stack
+		if ( frame[ 0 ] <= ebp )
+		{
+			i += 1;
+
+			break;
+		}
+
+		ebp = frame[ 0 ];
+	}
+
+	while ( i < depth )
+	{
+		pcs[ i ] = 0;
+
+		i += 1;
+	}
+}
+
+/* Record a sample if it's time to.
+   Called by trap on every timer interrupt, with interrupts disabled.
+*/
+void profsample ( struct trapframe* tf )
+{
+	struct profsample s;
+	struct profbuf*   pb;
+	struct proc*      p;
+	int               interval;
+
+	interval = profinterval;
+
+	if ( interval == 0 )
+	{
+		return;
+	}
+
+	pb = &profbufs[ cpuid() ];
+
+	pb->ntick += 1;
+
+	if ( pb->ntick < interval )
+	{
+		return;
+	}
+
+	pb->ntick = 0;
+
+	p = myproc();
+
+	s.pid      = p ? p->pid : 0;
+	s.cpu      = cpuid();
+	s.user     = ( tf->cs & 3 ) == DPL_USER;
+	s.pcs[ 0 ] = tf->eip;
+
+	if ( s.user )
+	{
+		userpcs( p, tf->ebp, s.pcs + 1, PROFDEPTH - 1 );
+	}
+	else
+	{
+		// getcallerpcs wants the address of the first argument of the frame
+		getcallerpcs( ( uint* ) tf->ebp + 2, s.pcs + 1, PROFDEPTH - 1 );
+	}
+
+	acquire( &pb->lock );
+
+	if ( pb->n == NPROFSAMPLE )
+	{
+		pb->nlost += 1;
+	}
+	else
+	{
+		pb->samples[ ( pb->head + pb->n ) % NPROFSAMPLE ] = s;
+
+		pb->n += 1;
+	}
+
+	release( &pb->lock );
+}
+
+
+// _________________________________________________________________________________
+
+// Read as many whole samples as fit in n bytes, from all CPUs
+static int profread ( struct inode* ip, char* dst, int n )
+{
+	struct profbuf* pb;
+	int             nread;
+	int             i;
+
+	nread = 0;
+
+	for ( i = 0; i < ncpu; i += 1 )
+	{
+		pb = &profbufs[ i ];
+
+		acquire( &pb->lock );
+
+		while ( pb->n > 0 && n - nread >= ( int ) sizeof( struct profsample ) )
+		{
+			memmove( dst + nread, &pb->samples[ pb->head ], sizeof( struct profsample ) );
+
+			pb->head  = ( pb->head + 1 ) % NPROFSAMPLE;
+			pb->n    -= 1;
+			nread    += sizeof( struct profsample );
+		}
+
+		release( &pb->lock );
+	}
+
+	return nread;
+}
+
+static int profioctl ( struct inode* ip, int request, ... )
+{
+	struct profbuf* pb;
+	int             interval;
+	int             nlost;
+	int             i;
+
+	if ( request == PROF_IOCTL_START )
+	{
+		if ( argint( 2, &interval ) < 0 || interval < 1 )
+		{
+			return - 1;
+		}
+
+		profinterval = 0;
+
+		for ( i = 0; i < ncpu; i += 1 )
+		{
+			pb = &profbufs[ i ];
+
+			acquire( &pb->lock );
+
+			pb->head  = 0;
+			pb->n     = 0;
+			pb->nlost = 0;
+
+			release( &pb->lock );
+		}
+
+		profinterval = interval;
+
+		return 0;
+	}
+
+	else if ( request == PROF_IOCTL_STOP )
+	{
+		profinterval = 0;
+
+		nlost = 0;
+
+		for ( i = 0; i < ncpu; i += 1 )
+		{
+			nlost += profbufs[ i ].nlost;
+		}
+
+		return nlost;
+	}
+
+	return - 1;
+}
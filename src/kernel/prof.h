@@ -0,0 +1,15 @@
+// Sampling profiler (see prof.c)
+
+#define PROF_IOCTL_START  1  // ioctl( fd, PROF_IOCTL_START, interval ), sample every 'interval' ticks
+#define PROF_IOCTL_STOP   2  // ioctl( fd, PROF_IOCTL_STOP ), returns the number of samples lost
+
+#define PROFDEPTH  8  // pcs per sample
+
+// What reading /dev/prof returns, one per sample
+struct profsample
+{
+	int    pid;             // 0 if the CPU wasn't running a process
+	ushort cpu;
+	ushort user;            // interrupted user code?
+	uint   pcs [ PROFDEPTH ];  // interrupted eip, then return addresses of its callers (0 filled)
+};
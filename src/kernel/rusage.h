@@ -0,0 +1,33 @@
+// Resource usage (see getrusage and getprocs in sysproc.c)
+
+#define RUSAGE_SELF       0
+#define RUSAGE_CHILDREN ( - 1 )  // children that have been waited for
+
+// Times are in clock ticks (see uptime)
+struct rusage
+{
+	uint utime;    // time spent in user mode
+	uint stime;    // time spent in the kernel
+	uint nvcsw;    // voluntary context switches (gave up the CPU to sleep)
+	uint nivcsw;   // involuntary context switches (preempted)
+	uint nfault;   // page faults
+	uint nswapin;  // page faults that read a page back from swap
+	uint inblock;  // disk blocks read
+	uint oublock;  // disk blocks written
+	uint rchar;    // bytes read with 'read'
+	uint wchar;    // bytes written with 'write'
+};
+
+// One process, as listed by getprocs
+struct procinfo
+{
+	int           pid;
+	int           ppid;
+	char          state;       // 'R' running, 'r' runnable, 'S' sleeping, 'Z' zombie, 'E' embryo
+	char          name [ 16 ];
+	int           nice;
+	int           prio;
+	int           cpu;
+	uint          sz;          // memory size (bytes)
+	struct rusage ru;
+};
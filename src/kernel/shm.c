@@ -0,0 +1,438 @@
+// Shared memory segments
+
+/* A segment is a set of physical pages that can be mapped into
+   the page tables of multiple processes at the same time.
+   Processes that have the segment attached see each other's
+   writes directly, without the kernel copying any bytes
+   (compare with pipe.c).
+
+   A process creates or looks up a segment by key with 'shmget',
+   maps it into its address space with 'shmat', and unmaps it
+   with 'shmdt'.
+
+   Segment i is always attached at the same virtual address,
+     SHM_BASE + i * SHM_MAXSIZE
+   (see memlayout.h). This means the page table itself records
+   which segments a process has attached, and no per-process
+   bookkeeping is needed:
+     . copyuvm (fork) calls 'shmfork' to attach the parent's
+       segments to the child
+     . freevm (exit, exec) calls 'shmrelease' to detach all
+       the segments
+
+   The pages are mapped with PTE_SHARED set so that deallocuvm
+   knows they are not owned by the page table.
+
+   A segment is destroyed (and its pages freed) when the last
+   page table it is attached to detaches it. A segment that was
+   never attached belongs to the process that created it, and is
+   destroyed when that process exits (see 'shmexit'). So a
+   process that hands a key to another one should attach the
+   segment before it can exit.
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shmseg
+{
+	int   used;                     // Slot in use
+	int   creating;                 // Pages still being allocated, can't be found or attached yet
+	int   key;                      // Key passed to shmget (0 if private)
+	int   creator;                  // pid of the process that created it
+	uint  npages;                   // Size of segment (pages)
+	int   nattach;                  // Number of page tables segment is mapped into
+	char* pages [ SHM_MAXPAGES ];   // Physical pages (kernel virtual addresses)
+};
+
+struct
+{
+	/* Held when looking up, creating, or changing
+	   the attach count of a segment
+	*/
+	struct spinlock lock;
+
+	struct shmseg   seg [ NSHM ];
+
+} shmtable;
+
+
+#define SHMADDR( id ) ( SHM_BASE + ( id ) * SHM_MAXSIZE )
+
+
+void shminit ( void )
+{
+	initlock( &shmtable.lock, "shmtable" );
+}
+
+
+// _________________________________________________________________________________
+
+// Free a segment's pages and slot.
+// Caller must hold shmtable.lock.
+static void shmfree ( struct shmseg* s )
+{
+	uint i;
+
+	for ( i = 0; i < s->npages; i += 1 )
+	{
+		kfree( s->pages[ i ] );
+
+		s->pages[ i ] = 0;
+	}
+
+	s->used     = 0;
+	s->creating = 0;
+	s->key      = 0;
+	s->creator  = 0;
+	s->npages   = 0;
+	s->nattach  = 0;
+}
+
+/* Return the segment with the given key, or 0.
+   Segments that are being created don't count.
+   Caller must hold shmtable.lock.
+*/
+static struct shmseg* shmlookup ( int key )
+{
+	struct shmseg* s;
+
+	for ( s = shmtable.seg; s < &shmtable.seg[ NSHM ]; s += 1 )
+	{
+		if ( s->used && ! s->creating && s->key == key )
+		{
+			return s;
+		}
+	}
+
+	return 0;
+}
+
+// Drop one attachment, destroying the segment on the last one.
+// Caller must hold shmtable.lock.
+static void shmput ( struct shmseg* s )
+{
+	if ( s->nattach < 1 )
+	{
+		panic( "shmput" );
+	}
+
+	s->nattach -= 1;
+
+	if ( s->nattach == 0 )
+	{
+		shmfree( s );
+	}
+}
+
+
+// _________________________________________________________________________________
+
+/* Return the id of the segment with the given key, creating it
+   (with 'size' bytes of zeroed memory) if it does not exist.
+   A key of 0 always creates a new (private) segment.
+   Returns -1 on error.
+*/
+int shmget ( int key, uint size )
+{
+	struct shmseg* s;
+	struct shmseg* other;
+	uint           npages,
+	               i;
+
+	if ( key < 0 || size == 0 || size > SHM_MAXSIZE )
+	{
+		return - 1;
+	}
+
+	npages = PGROUNDUP( size ) / PGSIZE;
+
+	acquire( &shmtable.lock );
+
+	// Found existing segment
+	if ( key != 0 && ( s = shmlookup( key ) ) != 0 )
+	{
+		release( &shmtable.lock );
+
+		return npages > s->npages ? - 1 : s - shmtable.seg;
+	}
+
+	for ( s = shmtable.seg; s < &shmtable.seg[ NSHM ]; s += 1 )
+	{
+		if ( ! s->used )
+		{
+			break;
+		}
+	}
+
+	if ( s == &shmtable.seg[ NSHM ] )
+	{
+		release( &shmtable.lock );
+
+		return - 1;
+	}
+
+
+	/* Create a new segment.
+	   Reserve the slot, and allocate the pages without holding
+	   the lock (there can be a lot of them). Nobody else looks
+	   at a slot that is still being created.
+	*/
+	s->used     = 1;
+	s->creating = 1;
+	s->key      = key;
+	s->creator  = myproc()->pid;
+	s->npages   = 0;
+	s->nattach  = 0;
+
+	release( &shmtable.lock );
+
+	for ( i = 0; i < npages; i += 1 )
+	{
+		s->pages[ i ] = kzalloc();
+
+		if ( s->pages[ i ] == 0 )
+		{
+			break;
+		}
+
+		s->npages += 1;
+	}
+
+	acquire( &shmtable.lock );
+
+	if ( s->npages < npages )
+	{
+		shmfree( s );
+
+		release( &shmtable.lock );
+
+		return - 1;
+	}
+
+	// Someone else created a segment with the same key meanwhile, use theirs
+	if ( key != 0 && ( other = shmlookup( key ) ) != 0 )
+	{
+		shmfree( s );
+
+		release( &shmtable.lock );
+
+		return npages > other->npages ? - 1 : other - shmtable.seg;
+	}
+
+	s->creating = 0;
+
+	release( &shmtable.lock );
+
+	return s - shmtable.seg;
+}
+
+/* Map segment 'id' into the current process's address space.
+   Returns the virtual address of the segment, or 0 on error.
+   Attaching an already attached segment returns its address.
+*/
+char* shmat ( int id )
+{
+	struct proc*   curproc;
+	struct shmseg* s;
+
+	if ( id < 0 || id >= NSHM )
+	{
+		return 0;
+	}
+
+	curproc = myproc();
+
+	s = &shmtable.seg[ id ];
+
+	acquire( &shmtable.lock );
+
+	if ( ! s->used || s->creating )
+	{
+		release( &shmtable.lock );
+
+		return 0;
+	}
+
+	if ( ! isshared( curproc->vm->pgdir, SHMADDR( id ) ) )
+	{
+		if ( mapshared( curproc->vm->pgdir, SHMADDR( id ), s->pages, s->npages ) < 0 )
+		{
+			release( &shmtable.lock );
+
+			return 0;
+		}
+
+		s->nattach += 1;
+	}
+
+	release( &shmtable.lock );
+
+	return ( char* ) SHMADDR( id );
+}
+
+/* Unmap the segment attached at 'addr' from the current
+   process's address space.
+   Returns 0 on success, -1 if no segment is attached there.
+*/
+int shmdt ( char* addr )
+{
+	struct proc*   curproc;
+	struct shmseg* s;
+	uint           a;
+	int            id;
+
+	a = ( uint ) addr;
+
+	if ( a < SHM_BASE || a >= SHM_BASE + NSHM * SHM_MAXSIZE || ( a - SHM_BASE ) % SHM_MAXSIZE )
+	{
+		return - 1;
+	}
+
+	curproc = myproc();
+
+	id = ( a - SHM_BASE ) / SHM_MAXSIZE;
+	s  = &shmtable.seg[ id ];
+
+	acquire( &shmtable.lock );
+
+	/* Not while there are other threads. They may be using the
+	   segment, on other CPUs with the old mappings still in their
+	   TLBs (see growproc).
+	*/
+	if ( ! s->used || ! isshared( curproc->vm->pgdir, a ) || curproc->vm->ref > 1 )
+	{
+		release( &shmtable.lock );
+
+		return - 1;
+	}
+
+	unmapshared( curproc->vm->pgdir, a, s->npages );
+
+	shmput( s );
+
+	release( &shmtable.lock );
+
+	// Flush stale TLB entries
+	switchuvm( curproc );
+
+	return 0;
+}
+
+
+// _________________________________________________________________________________
+
+// Attach all segments mapped in 'pgdir' to 'newPgdir' as well.
+// Called by copyuvm (fork).
+int shmfork ( pde_t* pgdir, pde_t* newPgdir )
+{
+	struct shmseg* s;
+	int            id;
+
+	acquire( &shmtable.lock );
+
+	for ( id = 0; id < NSHM; id += 1 )
+	{
+		s = &shmtable.seg[ id ];
+
+		if ( ! s->used || ! isshared( pgdir, SHMADDR( id ) ) )
+		{
+			continue;
+		}
+
+		if ( mapshared( newPgdir, SHMADDR( id ), s->pages, s->npages ) < 0 )
+		{
+			release( &shmtable.lock );
+
+			return - 1;
+		}
+
+		s->nattach += 1;
+	}
+
+	release( &shmtable.lock );
+
+	return 0;
+}
+
+// Detach all segments mapped in 'pgdir'.
+// Called by freevm (exit, exec).
+void shmrelease ( pde_t* pgdir )
+{
+	struct shmseg* s;
+	int            id;
+
+	acquire( &shmtable.lock );
+
+	for ( id = 0; id < NSHM; id += 1 )
+	{
+		s = &shmtable.seg[ id ];
+
+		if ( ! s->used || ! isshared( pgdir, SHMADDR( id ) ) )
+		{
+			continue;
+		}
+
+		unmapshared( pgdir, SHMADDR( id ), s->npages );
+
+		shmput( s );
+	}
+
+	release( &shmtable.lock );
+}
+
+/* Destroy the segments created by process 'pid' that were
+   never attached. Called by exit.
+   (Segments that were attached are destroyed on the last detach.)
+*/
+void shmexit ( int pid )
+{
+	struct shmseg* s;
+
+	acquire( &shmtable.lock );
+
+	for ( s = shmtable.seg; s < &shmtable.seg[ NSHM ]; s += 1 )
+	{
+		if ( s->used && ! s->creating && s->creator == pid && s->nattach == 0 )
+		{
+			shmfree( s );
+		}
+	}
+
+	release( &shmtable.lock );
+}
+
+/* Check whether [addr, addr + size) lies within a segment
+   attached to 'pgdir'. Lets system calls accept pointers
+   into shared memory (for ex. 'write' straight from a segment).
+*/
+int shmcontains ( pde_t* pgdir, uint addr, uint size )
+{
+	struct shmseg* s;
+	int            id,
+	               r;
+
+	if ( addr < SHM_BASE || addr >= SHM_BASE + NSHM * SHM_MAXSIZE )
+	{
+		return 0;
+	}
+
+	id = ( addr - SHM_BASE ) / SHM_MAXSIZE;
+	s  = &shmtable.seg[ id ];
+
+	acquire( &shmtable.lock );
+
+	r = s->used                                                      &&
+	    isshared( pgdir, SHMADDR( id ) )                             &&
+	    addr + size >= addr                                          &&
+	    addr + size <= SHMADDR( id ) + s->npages * PGSIZE;
+
+	release( &shmtable.lock );
+
+	return r;
+}
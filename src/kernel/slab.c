@@ -0,0 +1,421 @@
+// Slab allocator
+
+/* Hands out fixed size kernel objects (ex. struct pipe) that are
+   much smaller than a page, without wasting a whole page on each.
+
+   Each kind of object gets its own cache, created with 'slabcreate'.
+   A cache carves pages from kalloc into "slabs". A slab is one page
+   holding a 'struct slab' header followed by as many objects as fit.
+   Free objects in a slab are kept in a singly linked list. The link
+   is a word stored right after each object, not in the object, so
+   that it doesn't clobber the constructed state (see below).
+
+   A cache keeps its slabs in two lists:
+     . partial - slabs with at least one free object
+     . full    - slabs with no free objects
+   A slab whose objects are all free goes back to kalloc, except
+   for one which is kept around so that a cache that hovers around
+   a slab boundary doesn't keep allocating and freeing pages.
+
+   The slab an object belongs to is found by rounding the object's
+   address down to the page boundary.
+
+   Constructor:
+     If the cache has a constructor, it is called once for each
+     object when its slab is created, not on every slaballoc.
+     Callers must return objects to slabfree in their constructed
+     state (ex. with any locks in the object released). This saves
+     redoing work like initlock on every allocation.
+
+   Magazines:
+     Each CPU has a "magazine", a small stack of free objects, in
+     front of the slab lists (similar to the per-CPU page caches
+     in kalloc.c). slaballoc and slabfree only take the cache's
+     lock when the magazine is empty or full.
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+
+#define NSLABCACHE     16  // max number of caches
+#define SLAB_MAGSIZE   8   // objects per per-CPU magazine
+#define SLAB_ALIGN     4   // object alignment (bytes)
+
+
+// Slab header, stored at the start of the slab's page
+struct slab
+{
+	struct slab*      next;
+	struct slab*      prev;
+
+	struct slabcache* cache;
+	uint              ninuse;    // number of objects allocated from this slab
+	char*             freelist;  // free objects in this slab
+};
+
+struct magazine
+{
+	int   n;                        // number of objects in magazine
+	void* objs [ SLAB_MAGSIZE ];
+};
+
+struct slabcache
+{
+	struct spinlock lock;          // Held when modifying slab lists
+	char*           name;
+
+	uint            objsize;       // including the freelist link
+	uint            linkoff;       // offset of the freelist link in an object
+	uint            objsperslab;
+	void            ( *ctor ) ( void* );
+
+	struct slab     partial;       // List heads, not slabs
+	struct slab     full;
+	int             nempty;        // number of slabs in 'partial' with all objects free
+
+	uint            nslabs;        // statistics...
+	uint            ninuse;
+
+	struct magazine mag [ NCPU ];
+};
+
+struct
+{
+	struct spinlock  lock;
+	int              n;
+
+	struct slabcache caches [ NSLABCACHE ];
+
+} slabtable;
+
+
+void slabinit ( void )
+{
+	initlock( &slabtable.lock, "slabtable" );
+}
+
+
+// _________________________________________________________________________________
+
+static void listinit ( struct slab* head )
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static int listempty ( struct slab* head )
+{
+	return head->next == head;
+}
+
+static void listpush ( struct slab* head, struct slab* s )
+{
+	s->next          = head->next;
+	s->prev          = head;
+	head->next->prev = s;
+	head->next       = s;
+}
+
+static void listremove ( struct slab* s )
+{
+	s->prev->next = s->next;
+	s->next->prev = s->prev;
+}
+
+// Offset of the first object in a slab
+static uint firstobj ( void )
+{
+	return ( sizeof( struct slab ) + SLAB_ALIGN - 1 ) & ~ ( SLAB_ALIGN - 1 );
+}
+
+// The freelist link of object p (the next free object)
+static char** objlink ( struct slabcache* sc, char* p )
+{
+	return ( char** ) ( p + sc->linkoff );
+}
+
+
+// _________________________________________________________________________________
+
+/* Allocate and carve up a new slab, and add it to 'partial'.
+   Returns 0 if out of memory.
+   Caller must hold sc->lock.
+*/
+static struct slab* slabgrow ( struct slabcache* sc )
+{
+	struct slab* s;
+	char*        p;
+	uint         i;
+
+	s = ( struct slab* ) kalloc();
+
+	if ( s == 0 )
+	{
+		return 0;
+	}
+
+	s->cache    = sc;
+	s->ninuse   = 0;
+	s->freelist = 0;
+
+	// Thread objects onto the freelist (last object first, so that
+	// objects are handed out in address order)
+	for ( i = sc->objsperslab; i > 0; i -= 1 )
+	{
+		p = ( char* ) s + firstobj() + ( i - 1 ) * sc->objsize;
+
+		if ( sc->ctor )
+		{
+			sc->ctor( p );
+		}
+
+		*objlink( sc, p ) = s->freelist;
+
+		s->freelist = p;
+	}
+
+	listpush( &sc->partial, s );
+
+	sc->nslabs += 1;
+	sc->nempty += 1;
+
+	return s;
+}
+
+/* Take an object from the slab lists.
+   Returns 0 if out of memory.
+   Caller must hold sc->lock.
+*/
+static void* slabget ( struct slabcache* sc )
+{
+	struct slab* s;
+	char*        obj;
+
+	if ( listempty( &sc->partial ) )
+	{
+		if ( slabgrow( sc ) == 0 )
+		{
+			return 0;
+		}
+	}
+
+	s = sc->partial.next;
+
+	if ( s->ninuse == 0 )
+	{
+		sc->nempty -= 1;
+	}
+
+	obj         = s->freelist;
+	s->freelist = *objlink( sc, obj );
+	s->ninuse  += 1;
+
+	// Slab is now full
+	if ( s->freelist == 0 )
+	{
+		listremove( s );
+
+		listpush( &sc->full, s );
+	}
+
+	sc->ninuse += 1;
+
+	return obj;
+}
+
+/* Return an object to its slab.
+   Caller must hold sc->lock.
+*/
+static void slabput ( struct slabcache* sc, void* p )
+{
+	struct slab* s;
+
+	s = ( struct slab* ) PGROUNDDOWN( ( uint ) p );
+
+	if ( s->cache != sc )
+	{
+		panic( "slabfree: wrong cache" );
+	}
+
+	// Slab was full, move back to partial
+	if ( s->freelist == 0 )
+	{
+		listremove( s );
+
+		listpush( &sc->partial, s );
+	}
+
+	*objlink( sc, p ) = s->freelist;
+
+	s->freelist = p;
+	s->ninuse  -= 1;
+
+	sc->ninuse -= 1;
+
+	// All objects free
+	if ( s->ninuse == 0 )
+	{
+		// Keep one empty slab, release the rest
+		if ( sc->nempty > 0 )
+		{
+			listremove( s );
+
+			sc->nslabs -= 1;
+
+			kfree( ( char* ) s );
+		}
+		else
+		{
+			sc->nempty += 1;
+		}
+	}
+}
+
+
+// _________________________________________________________________________________
+
+/* Create a cache of objects of 'size' bytes.
+   'ctor' can be 0.
+   Returns 0 if there are no free cache slots.
+*/
+struct slabcache* slabcreate ( char* name, uint size, void ( *ctor ) ( void* ) )
+{
+	struct slabcache* sc;
+	uint              linkoff;
+
+	// Keep objects aligned, and make room for the freelist link after each
+	linkoff = ( size + SLAB_ALIGN - 1 ) & ~ ( SLAB_ALIGN - 1 );
+	size    = linkoff + sizeof( char* );
+
+	if ( firstobj() + size > PGSIZE )
+	{
+		panic( "slabcreate: object too big" );
+	}
+
+	acquire( &slabtable.lock );
+
+	if ( slabtable.n == NSLABCACHE )
+	{
+		release( &slabtable.lock );
+
+		return 0;
+	}
+
+	sc = &slabtable.caches[ slabtable.n ];
+
+	slabtable.n += 1;
+
+	release( &slabtable.lock );
+
+
+	initlock( &sc->lock, name );
+
+	sc->name        = name;
+	sc->objsize     = size;
+	sc->linkoff     = linkoff;
+	sc->objsperslab = ( PGSIZE - firstobj() ) / size;
+	sc->ctor        = ctor;
+
+	listinit( &sc->partial );
+	listinit( &sc->full );
+
+	return sc;
+}
+
+// Allocate an object from the cache.
+// Returns 0 if the memory cannot be allocated.
+void* slaballoc ( struct slabcache* sc )
+{
+	struct magazine* m;
+	void*            p;
+
+	pushcli();  // stay on this CPU while using its magazine
+
+	m = &sc->mag[ cpuid() ];
+
+	if ( m->n > 0 )
+	{
+		m->n -= 1;
+
+		p = m->objs[ m->n ];
+	}
+	else
+	{
+		acquire( &sc->lock );
+
+		p = slabget( sc );
+
+		release( &sc->lock );
+	}
+
+	popcli();
+
+	return p;
+}
+
+// Return an object to the cache it was allocated from.
+void slabfree ( struct slabcache* sc, void* p )
+{
+	struct magazine* m;
+	int              i;
+
+	pushcli();  // stay on this CPU while using its magazine
+
+	m = &sc->mag[ cpuid() ];
+
+	// Magazine full, return half of it to the slabs
+	if ( m->n == SLAB_MAGSIZE )
+	{
+		acquire( &sc->lock );
+
+		for ( i = 0; i < SLAB_MAGSIZE / 2; i += 1 )
+		{
+			m->n -= 1;
+
+			slabput( sc, m->objs[ m->n ] );
+		}
+
+		release( &sc->lock );
+	}
+
+	m->objs[ m->n ] = p;
+
+	m->n += 1;
+
+	popcli();
+}
+
+
+// _________________________________________________________________________________
+
+/* Print cache statistics to the console.
+   Runs when user types ^K on console (after kmemdump).
+   Objects sitting in magazines count as in use.
+*/
+void slabdump ( void )
+{
+	struct slabcache* sc;
+	int               n;
+
+	acquire( &slabtable.lock );
+
+	n = slabtable.n;
+
+	release( &slabtable.lock );
+
+	cprintf( "\ncache       objsize  slabs  inuse\n" );
+
+	for ( sc = slabtable.caches; sc < &slabtable.caches[ n ]; sc += 1 )
+	{
+		acquire( &sc->lock );
+
+		cprintf( "%s    %d      %d      %d\n", sc->name, sc->objsize, sc->nslabs, sc->ninuse );
+
+		release( &sc->lock );
+	}
+}
@@ -68,8 +68,9 @@ void releasesleep ( struct sleeplock* slk )
 	// Release sleeplock...
 	slk->locked = 0;
 
-	// Wakeup processes sleeping on the sleeplock...
-	wakeup( slk );
+	// Wakeup one of the processes sleeping on the sleeplock...
+	// (only one of them can get it)
+	wakeupone( slk );
 
 	// Releease spinlock...
 	release( &slk->lock );
@@ -0,0 +1,370 @@
+// Swap
+
+/* Lets user programs use more memory than there is physical memory,
+   by moving pages that haven't been used recently out to disk.
+
+   The swap area is a range of disk blocks right after the file
+   system (reserved by mkfs, see fs.h). It is divided into "slots",
+   one page each. 'used' keeps track of which slots hold a page.
+
+   Swapping out:
+     When kalloc runs out of memory while allocating a user page
+     (ukalloc), 'swapreclaim' looks for a page to evict with the
+     clock algorithm. A clock hand (process, virtual address) sweeps
+     over the memory of all processes. Pages whose PTE_A bit is set
+     get a second chance (the bit is cleared and the hand moves on).
+     The first page found with PTE_A clear is written to a free slot
+     and freed. Its PTE is marked PTE_SWAPPED and holds the slot
+     number instead of the physical address (see mmu.h).
+
+   Swapping in:
+     When a process touches a swapped out page, it page faults and
+     'swapfault' reads the page back. The kernel itself does not
+     fault on user memory, so system calls bring back the pages of
+     their arguments first (see fetchint, fetchstr, and argptr in
+     syscall.c).
+
+   Processes in the middle of a system call are never picked by
+   the clock hand (see swapbegin in proc.c), as the kernel may be
+   using their memory.
+
+   Swap I/O goes through the buffer cache, one block at a time.
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "date.h"
+#include "fs.h"
+#include "buf.h"
+#include "kconfig.h"
+
+
+#define BLOCKSPERSLOT  ( PGSIZE / BLOCKSIZE )
+#define MAXSLOTS       ( SWAPSIZE / BLOCKSPERSLOT )
+
+
+struct
+{
+	struct spinlock  lock;           // Held when using 'used'
+
+	/* Held while looking for a page to swap out. Only one
+	   process moves the clock hand at a time.
+	*/
+	struct sleeplock reclaimlock;
+
+	int              dev;
+	uint             start;          // first block of swap area
+	uint             nslots;         // 0 if there is no swap area
+
+	uchar            used [ MAXSLOTS ];
+	uint             next;           // no free slot below this one
+
+	int              handpid;        // clock hand, pid of process (see swapbegin)
+	uint             handva;         // clock hand, virtual address within handpid
+
+	uint             nswapout;       // statistics...
+	uint             nswapin;
+
+} swap;
+
+
+void swapinit ( int dev )
+{
+	struct superblock sb;
+
+	initlock( &swap.lock, "swap" );
+	initsleeplock( &swap.reclaimlock, "swapreclaim" );
+
+	readsb( dev, &sb );
+
+	swap.dev    = dev;
+	swap.start  = sb.swapstart;
+	swap.nslots = sb.nswapblocks / BLOCKSPERSLOT;
+
+	if ( swap.nslots > MAXSLOTS )
+	{
+		swap.nslots = MAXSLOTS;
+	}
+
+	cprintf( "swap: %d slots starting at block %d\n", swap.nslots, swap.start );
+}
+
+
+// _________________________________________________________________________________
+
+// Allocate a swap slot.
+// Returns -1 if swap is full.
+int swapalloc ( void )
+{
+	uint i;
+
+	acquire( &swap.lock );
+
+	for ( i = swap.next; i < swap.nslots; i += 1 )
+	{
+		if ( ! swap.used[ i ] )
+		{
+			swap.used[ i ] = 1;
+			swap.next      = i + 1;
+
+			release( &swap.lock );
+
+			return i;
+		}
+	}
+
+	swap.next = swap.nslots;
+
+	release( &swap.lock );
+
+	return - 1;
+}
+
+void swapfree ( int slot )
+{
+	if ( slot < 0 || slot >= swap.nslots )
+	{
+		panic( "swapfree: bad slot" );
+	}
+
+	acquire( &swap.lock );
+
+	if ( ! swap.used[ slot ] )
+	{
+		panic( "swapfree: slot not in use" );
+	}
+
+	swap.used[ slot ] = 0;
+
+	if ( slot < swap.next )
+	{
+		swap.next = slot;
+	}
+
+	release( &swap.lock );
+}
+
+// Write a page to swap slot 'slot'
+void swapwrite ( int slot, char* page )
+{
+	struct buf* b;
+	uint        i;
+
+	for ( i = 0; i < BLOCKSPERSLOT; i += 1 )
+	{
+		// No need to read the block, it's overwritten entirely
+		b = bgetblank( swap.dev, swap.start + slot * BLOCKSPERSLOT + i );
+
+		memmove( b->data, page + i * BLOCKSIZE, BLOCKSIZE );
+
+		bwrite( b );
+		brelse( b );
+	}
+
+	swap.nswapout += 1;
+}
+
+// Read a page from swap slot 'slot'
+void swapread ( int slot, char* page )
+{
+	struct buf* b;
+	uint        i;
+
+	for ( i = 0; i < BLOCKSPERSLOT; i += 1 )
+	{
+		b = bread( swap.dev, swap.start + slot * BLOCKSPERSLOT + i );
+
+		memmove( page + i * BLOCKSIZE, b->data, BLOCKSIZE );
+
+		brelse( b );
+	}
+
+	swap.nswapin += 1;
+}
+
+
+// _________________________________________________________________________________
+
+/* Swap out one user page, moving the clock hand across processes
+   until one is found.
+   Returns 0 if a page was freed, -1 if there is nothing to swap
+   out (or no room in swap).
+*/
+int swapreclaim ( void )
+{
+	struct proc* p;
+	int          slot;
+	int          pid;
+	int          nvisits;
+	int          r;
+
+	slot = swapalloc();
+
+	if ( slot < 0 )
+	{
+		return - 1;
+	}
+
+	acquiresleep( &swap.reclaimlock );
+
+	r = - 1;
+
+	/* Each process gets visited at most twice, the first pass over
+	   a process may only clear PTE_A bits.
+	*/
+	for ( nvisits = 0; nvisits < 2 * kconfig.nproc + 1 && r < 0; nvisits += 1 )
+	{
+		pid = swap.handpid;
+
+		p = swapbegin( &pid );
+
+		// Reached end of process list, wrap around
+		if ( p == 0 )
+		{
+			swap.handpid = 0;
+			swap.handva  = 0;
+
+			continue;
+		}
+
+		// Hand moved on to a different process
+		if ( pid != swap.handpid )
+		{
+			swap.handpid = pid;
+			swap.handva  = 0;
+		}
+
+		r = swapoutpage( p->vm->pgdir, p->vm->sz, &swap.handva, slot );
+
+		if ( r == 0 )
+		{
+			// Flush stale TLB entry
+			if ( p == myproc() )
+			{
+				switchuvm( p );
+			}
+		}
+		else
+		{
+			swap.handpid = pid + 1;
+			swap.handva  = 0;
+		}
+
+		swapend( p );
+	}
+
+	releasesleep( &swap.reclaimlock );
+
+	if ( r < 0 )
+	{
+		swapfree( slot );
+	}
+
+	return r;
+}
+
+/* Allocate a page for user memory, swapping out another user
+   page if there is no free memory.
+   Returns 0 if the memory cannot be allocated.
+*/
+char* ukalloc ( void )
+{
+	char* mem;
+
+	while ( 1 )
+	{
+		mem = kalloc();
+
+		if ( mem != 0 )
+		{
+			return mem;
+		}
+
+		if ( swapreclaim() < 0 )
+		{
+			return 0;
+		}
+	}
+}
+
+// Same as ukalloc, but the page is zeroed (see kzalloc)
+char* ukzalloc ( void )
+{
+	char* mem;
+
+	while ( 1 )
+	{
+		mem = kzalloc();
+
+		if ( mem != 0 )
+		{
+			return mem;
+		}
+
+		if ( swapreclaim() < 0 )
+		{
+			return 0;
+		}
+	}
+}
+
+/* Handle a page fault at 'va' by process p.
+   Returns 0 if it was a swapped out page that is now back,
+   -1 otherwise.
+*/
+int swapfault ( struct proc* p, uint va )
+{
+	int r;
+
+	if ( va >= p->vm->sz )
+	{
+		return - 1;
+	}
+
+	// Keep the clock hand off our memory while we fix it up
+	p->insyscall = 1;
+
+	r = swapinpage( p->vm->pgdir, va );
+
+	p->insyscall = 0;
+
+	if ( r == 0 )
+	{
+		p->acct.nswapin += 1;
+	}
+
+	return r;
+}
+
+
+// _________________________________________________________________________________
+
+// Print swap statistics to the console.
+// Runs when user types ^K on console (after slabdump).
+void swapdump ( void )
+{
+	uint i,
+	     nused;
+
+	acquire( &swap.lock );
+
+	nused = 0;
+
+	for ( i = 0; i < swap.nslots; i += 1 )
+	{
+		nused += swap.used[ i ];
+	}
+
+	release( &swap.lock );
+
+	cprintf( "\nswap: %d/%d slots used, %d pages out, %d pages in\n",
+
+		nused, swap.nslots, swap.nswapout, swap.nswapin
+	);
+}
@@ -26,7 +26,13 @@ int fetchint ( uint addr, int* intPtr )
 
 	// Check that the address lies within the user address space
 	// Why not just check (addr + 4) ??
-	if ( ( addr >= curproc->sz ) || ( addr + 4 > curproc->sz ) )
+	if ( ( addr >= curproc->vm->sz ) || ( addr + 4 > curproc->vm->sz ) )
+	{
+		return - 1;
+	}
+
+	// Bring the page(s) back if swapped out
+	if ( swapinrange( curproc->vm->pgdir, addr, 4 ) < 0 )
 	{
 		return - 1;
 	}
@@ -51,7 +57,7 @@ int fetchstr ( uint addr, char** strPtr )
 	curproc = myproc();
 
 	// Check that points to address within user address space
-	if ( addr >= curproc->sz )
+	if ( addr >= curproc->vm->sz )
 	{
 		return - 1;
 	}
@@ -61,10 +67,17 @@ int fetchstr ( uint addr, char** strPtr )
 
 
 	// Check that entire string lies within user address space
-	boundary = ( char* ) curproc->sz;
+	boundary = ( char* ) curproc->vm->sz;
 
 	for ( s = *strPtr; s < boundary; s += 1 )
 	{
+		// Bring the page back if swapped out
+		if ( ( s == *strPtr || ( uint ) s % PGSIZE == 0 ) &&
+		     swapinrange( curproc->vm->pgdir, ( uint ) s, 1 ) < 0 )
+		{
+			return - 1;
+		}
+
 		// Reached a null terminal while in bounds
 		if ( *s == 0 )
 		{
@@ -109,10 +122,22 @@ int argptr ( int n, char** memPtrPtr, int memSize )
 		return - 1;
 	}
 
+	if ( memSize < 0 )
+	{
+		return - 1;
+	}
+
 	// Check that points to address within user address space
-	if ( memSize < 0                             ||
-	     ( uint ) arg           >= curproc->sz   ||
-	     ( uint ) arg + memSize >  curproc->sz )
+	// (or within an attached shared memory segment)
+	if ( ( ( uint ) arg           >= curproc->vm->sz   ||
+	       ( uint ) arg + memSize >  curproc->vm->sz ) &&
+	     ! shmcontains( curproc->vm->pgdir, ( uint ) arg, memSize ) )
+	{
+		return - 1;
+	}
+
+	// Bring the page(s) back if swapped out
+	if ( swapinrange( curproc->vm->pgdir, ( uint ) arg, memSize ) < 0 )
 	{
 		return - 1;
 	}
@@ -125,8 +150,8 @@ int argptr ( int n, char** memPtrPtr, int memSize )
 
 // Fetch the nth system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (Shared memory segments are not accepted here, so the string can't
+// change between this check and being used by the kernel.)
 int argstr ( int n, char** strPtr )
 {
 	int arg;
@@ -163,6 +188,19 @@ extern int sys_unlink  ( void );
 extern int sys_uptime  ( void );
 extern int sys_wait    ( void );
 extern int sys_write   ( void );
+extern int sys_shmget  ( void );
+extern int sys_shmat   ( void );
+extern int sys_shmdt   ( void );
+extern int sys_nice    ( void );
+extern int sys_setpriority ( void );
+extern int sys_setaffinity ( void );
+extern int sys_getaffinity ( void );
+extern int sys_clone   ( void );
+extern int sys_join    ( void );
+extern int sys_futexwait ( void );
+extern int sys_futexwake ( void );
+extern int sys_getrusage ( void );
+extern int sys_getprocs  ( void );
 
 // Array of function pointers
 static int ( *syscalls [] )( void ) = {
@@ -191,6 +229,19 @@ static int ( *syscalls [] )( void ) = {
 	[ SYS_uptime  ] sys_uptime,
 	[ SYS_wait    ] sys_wait,
 	[ SYS_write   ] sys_write,
+	[ SYS_shmget  ] sys_shmget,
+	[ SYS_shmat   ] sys_shmat,
+	[ SYS_shmdt   ] sys_shmdt,
+	[ SYS_nice    ] sys_nice,
+	[ SYS_setpriority ] sys_setpriority,
+	[ SYS_setaffinity ] sys_setaffinity,
+	[ SYS_getaffinity ] sys_getaffinity,
+	[ SYS_clone   ] sys_clone,
+	[ SYS_join    ] sys_join,
+	[ SYS_futexwait ] sys_futexwait,
+	[ SYS_futexwake ] sys_futexwake,
+	[ SYS_getrusage ] sys_getrusage,
+	[ SYS_getprocs  ] sys_getprocs,
 };
 
 void syscall ( void )
@@ -211,7 +262,11 @@ void syscall ( void )
 		   from the trapframe into the CPU's registers.
 		   Thus %eax will hold the value returned by the syscall.
 		*/
+		curproc->insyscall = 1;
+
 		curproc->tf->eax = syscalls[ num ]();
+
+		curproc->insyscall = 0;
 	}
 	else
 	{
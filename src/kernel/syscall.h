@@ -23,3 +23,16 @@
 #define SYS_uptime  22
 #define SYS_wait    23
 #define SYS_write   24
+#define SYS_shmget  25
+#define SYS_shmat   26
+#define SYS_shmdt   27
+#define SYS_nice    28
+#define SYS_setpriority 29
+#define SYS_setaffinity 30
+#define SYS_getaffinity 31
+#define SYS_clone   32
+#define SYS_join    33
+#define SYS_futexwait 34
+#define SYS_futexwake 35
+#define SYS_getrusage 36
+#define SYS_getprocs  37
@@ -21,28 +21,41 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fdtable.h"
 #include "fcntl.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+/* The file comes with a reference of its own (another thread may
+   close the fd while we use it), the caller must fileclose it when
+   done. So call argfd after the other args, it's the last thing that
+   can fail.
+*/
 static int argfd ( int n, int* pfd, struct file** pf )
 {
-	struct file* f;
-	int          fd;
+	struct fdtable* t;
+	struct file*    f;
+	int             fd;
 
 	if ( argint( n, &fd ) < 0 )
 	{
 		return - 1;
 	}
 
+	t = myproc()->files;
+
+	// Another thread may be growing the table (see fdtgrow)
+	acquire( &t->lock );
+
 	// Check that valid file descriptor
-	if ( fd < 0 || fd >= NOPENFILE_PROC )
+	f = fd >= 0 && fd < t->nofile ? t->ofile[ fd ] : 0;
+
+	if ( f )
 	{
-		return - 1;
+		filedup( f );
 	}
 
-
-	f = myproc()->ofile[ fd ];
+	release( &t->lock );
 
 	if ( f == 0 )
 	{
@@ -73,22 +86,34 @@ static int argfd ( int n, int* pfd, struct file** pf )
 */
 static int fdalloc ( struct file* f )
 {
-	struct proc* curproc;
-	int          fd;
+	struct fdtable* t;
+	int             fd;
 
 	//
-	curproc = myproc();
+	t = myproc()->files;
+
+	acquire( &t->lock );  // other threads may be allocating too
 
-	for ( fd = 0; fd < NOPENFILE_PROC; fd += 1 )
+	for ( fd = 0; fd < t->nofile; fd += 1 )
 	{
-		if ( curproc->ofile[ fd ] == 0 )
+		if ( t->ofile[ fd ] == 0 )
 		{
-			curproc->ofile[ fd ] = f;
-
-			return fd;
+			break;
 		}
 	}
 
+	// All taken, make room for more (up to kconfig.nofile)
+	if ( fd < t->nofile || fdtgrow( t ) == 0 )
+	{
+		t->ofile[ fd ] = f;
+
+		release( &t->lock );
+
+		return fd;
+	}
+
+	release( &t->lock );
+
 	return - 1;
 }
 
@@ -105,15 +130,15 @@ int sys_dup ( void )
 		return - 1;
 	}
 
-	newfd = fdalloc( f );  // in addition to existing...
+	newfd = fdalloc( f );  // takes over the reference from argfd
 
 	if ( newfd < 0 )
 	{
+		fileclose( f );
+
 		return - 1;
 	}
 
-	filedup( f );  // increment ref count of file f
-
 	return newfd;
 }
 
@@ -123,14 +148,23 @@ int sys_read ( void )
 	char*        p;
 	int          n;
 
-	if ( argfd( 0, 0, &f )  < 0   ||
-		 argint( 2, &n )    < 0   ||
-		 argptr( 1, &p, n ) < 0 )
+	if ( argint( 2, &n )    < 0   ||
+		 argptr( 1, &p, n ) < 0   ||
+		 argfd( 0, 0, &f )  < 0 )
 	{
 		return - 1;
 	}
 
-	return fileread( f, p, n );
+	n = fileread( f, p, n );
+
+	fileclose( f );
+
+	if ( n > 0 )
+	{
+		myproc()->acct.rchar += n;
+	}
+
+	return n;
 }
 
 int sys_write ( void )
@@ -139,29 +173,56 @@ int sys_write ( void )
 	char*        p;
 	int          n;
 
-	if ( argfd( 0, 0, &f )  < 0   ||
-		 argint( 2, &n )    < 0   ||
-		 argptr( 1, &p, n ) < 0 )
+	if ( argint( 2, &n )    < 0   ||
+		 argptr( 1, &p, n ) < 0   ||
+		 argfd( 0, 0, &f )  < 0 )
 	{
 		return - 1;
 	}
 
-	return filewrite( f, p, n );
+	n = filewrite( f, p, n );
+
+	fileclose( f );
+
+	if ( n > 0 )
+	{
+		myproc()->acct.wchar += n;
+	}
+
+	return n;
 }
 
 int sys_close ( void )
 {
-	struct file* f;
-	int          fd;
+	struct file*    f;
+	struct fdtable* t;
+	int             fd;
 
 	if ( argfd( 0, &fd, &f ) < 0 )
 	{
 		return - 1;
 	}
 
-	myproc()->ofile[ fd ] = 0;
+	t = myproc()->files;
 
-	fileclose( f );
+	// Another thread may have closed it meanwhile
+	acquire( &t->lock );
+
+	if ( t->ofile[ fd ] != f )
+	{
+		release( &t->lock );
+
+		fileclose( f );
+
+		return - 1;
+	}
+
+	t->ofile[ fd ] = 0;
+
+	release( &t->lock );
+
+	fileclose( f );  // the table's reference
+	fileclose( f );  // argfd's
 
 	return 0;
 }
@@ -170,14 +231,19 @@ int sys_fstat ( void )
 {
 	struct file* f;
 	struct stat* st;
+	int          r;
 
-	if ( argfd( 0, 0, &f ) < 0 ||
-		 argptr( 1, ( void* ) &st, sizeof( *st ) ) < 0 )
+	if ( argptr( 1, ( void* ) &st, sizeof( *st ) ) < 0 ||
+		 argfd( 0, 0, &f ) < 0 )
 	{
 		return - 1;
 	}
 
-	return filestat( f, st );
+	r = filestat( f, st );
+
+	fileclose( f );
+
+	return r;
 }
 
 
@@ -728,6 +794,7 @@ int sys_chdir ( void )
 {
 	char*         path;
 	struct inode* ip;
+	struct inode* old;
 	struct proc*  curproc;
 
 	curproc = myproc();
@@ -766,11 +833,18 @@ int sys_chdir ( void )
 	iunlock( ip );
 
 
-	iput( curproc->cwd );
+	// Threads share the cwd (see fdtable)
+	acquire( &curproc->files->lock );
 
-	end_op();
+	old = curproc->files->cwd;
 
-	curproc->cwd = ip;
+	curproc->files->cwd = ip;
+
+	release( &curproc->files->lock );
+
+	iput( old );
+
+	end_op();
 
 	return 0;
 }
@@ -880,7 +954,11 @@ int sys_pipe ( void )
 	if ( fd1 < 0 )
 	{
 		// fd0 was successfully allocated, deallocate it
-		myproc()->ofile[ fd0 ] = 0;
+		acquire( &myproc()->files->lock );
+
+		myproc()->files->ofile[ fd0 ] = 0;
+
+		release( &myproc()->files->lock );
 
 		fileclose( rf );
 
@@ -910,24 +988,30 @@ int sys_ioctl ( void )
 {
 	struct file* f;
 	int          request;
+	int          r;
 
-	if ( argfd( 0, 0, &f ) < 0      ||
-		 argint( 1, &request ) < 0 )
+	if ( argint( 1, &request ) < 0 ||
+		 argfd( 0, 0, &f ) < 0 )
 	{
 		return - 1;
 	}
 
 	if ( ( f->type != FD_INODE ) || ( f->ip->type != T_DEV ) )
 	{
-		return - 1;
+		r = - 1;
 	}
-
-	if ( f->ip->major < 0 || f->ip->major >= NDEV || ! devsw[ f->ip->major ].ioctl )
+	else if ( f->ip->major < 0 || f->ip->major >= NDEV || ! devsw[ f->ip->major ].ioctl )
 	{
-		return - 1;
+		r = - 1;
+	}
+	else
+	{
+		r = devsw[ f->ip->major ].ioctl( f->ip, request );
 	}
 
-	return devsw[ f->ip->major ].ioctl( f->ip, request );
+	fileclose( f );
+
+	return r;
 }
 
 
@@ -944,11 +1028,8 @@ int sys_ioctl ( void )
            https://stackoverflow.com/a/59886657
            https://stackoverflow.com/a/24223731
 */
-int sys_lseek ( void )
+static int filelseek ( struct file* f, uint offset, int whence )
 {
-	struct file* f;
-	int          whence;
-	uint         offset;
 	uint         newOffset;
 
 	char*        zeros;
@@ -958,15 +1039,6 @@ int sys_lseek ( void )
 	char*        ptr;
 
 
-	// Get args from user stack
-	if ( argfd( 0, 0, &f ) < 0                 ||
-		 argint( 1, ( int* ) ( &offset ) ) < 0 ||
-		 argint( 1, &whence ) < 0 )
-	{
-		return - 1;
-	}
-
-
 	// Check that not seeking a pipe
 	if ( f->type == FD_PIPE )
 	{
@@ -1050,3 +1122,25 @@ int sys_lseek ( void )
 
 	return newOffset;
 }
+
+int sys_lseek ( void )
+{
+	struct file* f;
+	int          whence;
+	uint         offset;
+	int          r;
+
+	// Get args from user stack
+	if ( argint( 1, ( int* ) ( &offset ) ) < 0 ||
+		 argint( 1, &whence ) < 0              ||
+		 argfd( 0, 0, &f ) < 0 )
+	{
+		return - 1;
+	}
+
+	r = filelseek( f, offset, whence );
+
+	fileclose( f );
+
+	return r;
+}
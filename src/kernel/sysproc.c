@@ -4,6 +4,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "rusage.h"
+#include "kconfig.h"
 
 
 int sys_fork ( void )
@@ -47,15 +49,28 @@ int sys_sbrk ( void )
 {
 	int addr;
 	int n;
+	int r;
 
 	if ( argint( 0, &n ) < 0 )
 	{
 		return - 1;
 	}
 
-	addr = myproc()->sz;
+	addr = myproc()->vm->sz;
 
-	if ( growproc( n ) < 0 )
+	/* sbrk doesn't use the process's user memory, so let swap.c
+	   reclaim the process's own pages if growproc runs out of
+	   memory (see swapbegin). Only our own reclaims, other
+	   processes still leave us alone while growproc changes
+	   the page table.
+	*/
+	myproc()->reclaimself = 1;
+
+	r = growproc( n );
+
+	myproc()->reclaimself = 0;
+
+	if ( r < 0 )
 	{
 		return - 1;
 	}
@@ -63,6 +78,246 @@ int sys_sbrk ( void )
 	return addr;
 }
 
+/* Shared memory. See shm.c
+*/
+int sys_shmget ( void )
+{
+	int key;
+	int size;
+
+	if ( argint( 0, &key ) < 0 || argint( 1, &size ) < 0 )
+	{
+		return - 1;
+	}
+
+	return shmget( key, size );
+}
+
+int sys_shmat ( void )
+{
+	int   id;
+	char* addr;
+
+	if ( argint( 0, &id ) < 0 )
+	{
+		return - 1;
+	}
+
+	addr = shmat( id );
+
+	if ( addr == 0 )
+	{
+		return - 1;
+	}
+
+	return ( int ) addr;
+}
+
+int sys_shmdt ( void )
+{
+	int addr;
+
+	if ( argint( 0, &addr ) < 0 )
+	{
+		return - 1;
+	}
+
+	return shmdt( ( char* ) addr );
+}
+
+/* Scheduling priority. See "Priorities" in proc.c
+*/
+// Add 'inc' to the caller's base priority level (larger is lower
+// priority). Returns the new level.
+int sys_nice ( void )
+{
+	int inc;
+
+	if ( argint( 0, &inc ) < 0 )
+	{
+		return - 1;
+	}
+
+	setpriority( myproc()->pid, myproc()->nice + inc );
+
+	return myproc()->nice;
+}
+
+int sys_setpriority ( void )
+{
+	int pid;
+	int nice;
+
+	if ( argint( 0, &pid ) < 0 || argint( 1, &nice ) < 0 )
+	{
+		return - 1;
+	}
+
+	return setpriority( pid, nice );
+}
+
+/* CPU affinity. See "Affinity and balancing" in proc.c
+   pid 0 is the caller.
+*/
+int sys_setaffinity ( void )
+{
+	int          pid;
+	int          mask;
+	struct proc* curproc;
+
+	if ( argint( 0, &pid ) < 0 || argint( 1, &mask ) < 0 )
+	{
+		return - 1;
+	}
+
+	curproc = myproc();
+
+	if ( pid == 0 )
+	{
+		pid = curproc->pid;
+	}
+
+	if ( setaffinity( pid, mask ) < 0 )
+	{
+		return - 1;
+	}
+
+	// Not allowed on this CPU anymore, get off it (see rqbalance)
+	if ( pid == curproc->pid && ( curproc->affinity & ( 1 << curproc->cpu ) ) == 0 )
+	{
+		yield();
+	}
+
+	return 0;
+}
+
+int sys_getaffinity ( void )
+{
+	int pid;
+
+	if ( argint( 0, &pid ) < 0 )
+	{
+		return - 1;
+	}
+
+	if ( pid == 0 )
+	{
+		pid = myproc()->pid;
+	}
+
+	return getaffinity( pid );
+}
+
+/* Threads. See clone in proc.c
+*/
+int sys_clone ( void )
+{
+	int stack;
+
+	if ( argint( 0, &stack ) < 0 )
+	{
+		return - 1;
+	}
+
+	return clone( ( char* ) stack );
+}
+
+// join( void** stack ), stack can be 0
+int sys_join ( void )
+{
+	int    addr;
+	char*  p;
+	char*  ustack;
+	int    pid;
+
+	if ( argint( 0, &addr ) < 0 )
+	{
+		return - 1;
+	}
+
+	if ( addr != 0 && argptr( 0, &p, sizeof( char* ) ) < 0 )
+	{
+		return - 1;
+	}
+
+	pid = join( &ustack );
+
+	if ( pid >= 0 && addr != 0 )
+	{
+		*( ( char** ) addr ) = ustack;
+	}
+
+	return pid;
+}
+
+/* Futexes. See futex.c
+*/
+int sys_futexwait ( void )
+{
+	char* addr;
+	int   val;
+
+	if ( argptr( 0, &addr, sizeof( int ) ) < 0 || argint( 1, &val ) < 0 )
+	{
+		return - 1;
+	}
+
+	return futexwait( ( int* ) addr, val );
+}
+
+int sys_futexwake ( void )
+{
+	char* addr;
+	int   n;
+
+	if ( argptr( 0, &addr, sizeof( int ) ) < 0 || argint( 1, &n ) < 0 )
+	{
+		return - 1;
+	}
+
+	return futexwake( ( int* ) addr, n );
+}
+
+/* Resource usage, see rusage.h
+*/
+int sys_getrusage ( void )
+{
+	struct rusage* ru;
+	int            who;
+
+	if ( argint( 0, &who ) < 0 || argptr( 1, ( void* ) &ru, sizeof( *ru ) ) < 0 )
+	{
+		return - 1;
+	}
+
+	return getrusage( who, ru );
+}
+
+// getprocs( struct procinfo* info, int n )
+int sys_getprocs ( void )
+{
+	struct procinfo* info;
+	int              n;
+
+	if ( argint( 1, &n ) < 0 || n < 0 )
+	{
+		return - 1;
+	}
+
+	// There can't be more, and keeps n * sizeof from overflowing
+	if ( n > kconfig.nproc )
+	{
+		n = kconfig.nproc;
+	}
+
+	if ( argptr( 0, ( void* ) &info, n * sizeof( struct procinfo ) ) < 0 )
+	{
+		return - 1;
+	}
+
+	return getprocs( info, n );
+}
+
 int sys_sleep ( void )
 {
 	int  nTicks;
@@ -86,7 +341,8 @@ int sys_sleep ( void )
 			return - 1;
 		}
 
-		sleep( &ticks, &tickslock );
+		// Nobody wakes &ticks, the timer does
+		sleeptimeout( &ticks, &tickslock, nTicks - ( ticks - ticksInitial ) );
 	}
 
 	release( &tickslock );
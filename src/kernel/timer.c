@@ -0,0 +1,204 @@
+// Kernel timers
+
+/* Runs a callback once after a given number of clock ticks.
+
+   Previously, sys_sleep slept on &ticks and the timer interrupt
+   woke up every sleeping process on every tick, just so each could
+   check whether its time was up and go back to sleep. Now each
+   sleeper adds a timer, and the tick only touches the timers that
+   are due (see sleeptimeout in proc.c).
+
+   The timers are kept in a two level "timer wheel":
+     . level 0 has one slot per tick for the next NSLOTS ticks.
+       Timers due within that window go in slot expires % NSLOTS
+     . level 1 has one slot per NSLOTS ticks, for timers further
+       out. When level 0 wraps around, the timers in the level 1
+       slot that is now within reach are "cascaded" down, re-added
+       to level 0. Timers too far out even for level 1 go in its
+       last slot, and are re-added (again) when it comes up
+
+   Adding and removing a timer is O(1). A tick is O(1) plus the
+   timers that fire, and every NSLOTS ticks a cascade.
+
+   The wheel is advanced by CPU 0's timer interrupt (see trap.c).
+   Callbacks run from there, with timerlock held and interrupts
+   off, so they must be short and must not add or remove timers.
+   This also means that once timerdel returns, the callback is not
+   running and won't run.
+*/
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "timer.h"
+
+
+#define NSLOTSBITS  6
+#define NSLOTS      ( 1 << NSLOTSBITS )  // slots per level
+#define SLOTMASK    ( NSLOTS - 1 )
+
+
+static struct spinlock timerlock;
+
+static struct
+{
+	uint          now;                // last tick processed
+
+	struct timer* level0 [ NSLOTS ];  // slot i: timers due at a tick = i (mod NSLOTS)
+	struct timer* level1 [ NSLOTS ];  // slot i: timers due at a tick / NSLOTS = i (mod NSLOTS)
+
+} wheel;
+
+
+void timerinit ( void )
+{
+	initlock( &timerlock, "timer" );
+}
+
+
+// _________________________________________________________________________________
+
+static void slotpush ( struct timer** slot, struct timer* t )
+{
+	t->next  = *slot;
+	t->pprev = slot;
+
+	if ( *slot )
+	{
+		( *slot )->pprev = &t->next;
+	}
+
+	*slot = t;
+}
+
+static void slotremove ( struct timer* t )
+{
+	*t->pprev = t->next;
+
+	if ( t->next )
+	{
+		t->next->pprev = t->pprev;
+	}
+
+	t->next  = 0;
+	t->pprev = 0;
+}
+
+// Put t in the slot for t->expires.
+// Caller must hold timerlock.
+static void wheeladd ( struct timer* t )
+{
+	uint delta;
+
+	delta = t->expires - wheel.now;
+
+	if ( delta < NSLOTS )
+	{
+		slotpush( &wheel.level0[ t->expires & SLOTMASK ], t );
+	}
+	else if ( delta < NSLOTS * NSLOTS )
+	{
+		slotpush( &wheel.level1[ ( t->expires >> NSLOTSBITS ) & SLOTMASK ], t );
+	}
+	else
+	{
+		// Furthest level 1 slot, gets re-added when it cascades
+		slotpush( &wheel.level1[ ( ( wheel.now + NSLOTS * NSLOTS - 1 ) >> NSLOTSBITS ) & SLOTMASK ], t );
+	}
+}
+
+
+// _________________________________________________________________________________
+
+/* Call fn( arg ) after 'nticks' ticks (at least one).
+   t must not already be pending, and must stay allocated until
+   fn has run or timerdel is called.
+*/
+void timeradd ( struct timer* t, uint nticks, void ( *fn ) ( void* ), void* arg )
+{
+	if ( nticks == 0 )
+	{
+		nticks = 1;
+	}
+
+	acquire( &timerlock );
+
+	t->expires = wheel.now + nticks;
+	t->fn      = fn;
+	t->arg     = arg;
+	t->pending = 1;
+
+	wheeladd( t );
+
+	release( &timerlock );
+}
+
+/* Cancel t.
+   Returns 1 if it was still pending, 0 if fn has already run.
+   Either way, fn is not running when timerdel returns.
+*/
+int timerdel ( struct timer* t )
+{
+	int wasPending;
+
+	acquire( &timerlock );
+
+	wasPending = t->pending;
+
+	if ( wasPending )
+	{
+		slotremove( t );
+
+		t->pending = 0;
+	}
+
+	release( &timerlock );
+
+	return wasPending;
+}
+
+/* Advance the wheel up to tick 'now', running the callbacks of
+   the timers that are due.
+   Called by CPU 0 on every timer interrupt.
+*/
+void timertick ( uint now )
+{
+	struct timer* t;
+	struct timer* cascade;
+
+	acquire( &timerlock );
+
+	while ( wheel.now != now )
+	{
+		wheel.now += 1;
+
+		// Level 0 wrapped around, bring down the next NSLOTS ticks' worth
+		if ( ( wheel.now & SLOTMASK ) == 0 )
+		{
+			cascade = wheel.level1[ ( wheel.now >> NSLOTSBITS ) & SLOTMASK ];
+
+			wheel.level1[ ( wheel.now >> NSLOTSBITS ) & SLOTMASK ] = 0;
+
+			while ( cascade )
+			{
+				t       = cascade;
+				cascade = t->next;
+
+				wheeladd( t );
+			}
+		}
+
+		// Everything in this slot is due now
+		while ( ( t = wheel.level0[ wheel.now & SLOTMASK ] ) != 0 )
+		{
+			slotremove( t );
+
+			t->pending = 0;
+
+			t->fn( t->arg );
+		}
+	}
+
+	release( &timerlock );
+}
@@ -0,0 +1,11 @@
+// A callback that runs once after some number of ticks, see timer.c
+struct timer
+{
+	uint           expires;         // tick at which fn runs
+	void           ( *fn ) ( void* );
+	void*          arg;
+
+	int            pending;         // in the wheel, fn hasn't run yet
+	struct timer*  next;            // wheel slot list
+	struct timer** pprev;           // points at whatever points to us, for O(1) removal
+};
@@ -69,6 +69,7 @@ static char* trapnames [] = {
 	[ T_IRQ0 + IRQ_MOUSE    ] "IRQ_MOUSE",
 	[ T_IRQ0 + IRQ_IDE      ] "IRQ_IDE",
 	[ T_IRQ0 + IRQ_ERROR    ] "IRQ_ERROR",
+	[ T_IRQ0 + IRQ_WAKEUP   ] "IRQ_WAKEUP",
 	[ T_IRQ0 + IRQ_SPURIOUS ] "IRQ_SPURIOUS",
 
 	[ T_SYSCALL ] "T_SYSCALL"
@@ -138,11 +139,15 @@ void trap ( struct trapframe *tf )
 
 				ticks += 1;
 
-				wakeup( &ticks );
-
 				release( &tickslock );
+
+				timertick( ticks );  // run due timers (sys_sleep etc)
 			}
 
+			accttick( ( tf->cs & 3 ) == DPL_USER );
+
+			profsample( tf );
+
 			lapiceoi();
 
 			break;
@@ -163,6 +168,15 @@ void trap ( struct trapframe *tf )
 			break;
 
 
+		// Another CPU put work on our run queue while we were halted.
+		// Nothing to do, the scheduler takes it from here.
+		case T_IRQ0 + IRQ_WAKEUP:
+
+			lapiceoi();
+
+			break;
+
+
 		// Keyboard interrupt
 		case T_IRQ0 + IRQ_KBD:
 
@@ -270,6 +284,21 @@ void trap ( struct trapframe *tf )
 		*/
 
 
+		// Swapped out page (see swap.c)
+		case T_PGFLT:
+
+			if ( myproc() && ( tf->cs & 3 ) == DPL_USER )
+			{
+				myproc()->acct.nfault += 1;
+			}
+
+			if ( myproc() && ( tf->cs & 3 ) == DPL_USER && swapfault( myproc(), rcr2() ) == 0 )
+			{
+				break;
+			}
+
+			/* fall through */
+
 		// Default
 		default:
 
@@ -333,11 +362,12 @@ void trap ( struct trapframe *tf )
 		exit();
 	}
 
-	// Force process to give up CPU on clock tick.
+	// Force process to give up CPU when its quantum is up (see schedtick).
 	// If interrupts were on while locks held, would need to check nlock.
 	if ( myproc()                           &&
 	     myproc()->state == RUNNING         &&
-	     tf->trapno == T_IRQ0 + IRQ_TIMER )
+	     tf->trapno == T_IRQ0 + IRQ_TIMER   &&
+	     schedtick() )
 	{
 		yield();
 	}
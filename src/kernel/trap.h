@@ -42,4 +42,5 @@
 #define IRQ_MOUSE     12
 #define IRQ_IDE       14
 #define IRQ_ERROR     19
+#define IRQ_WAKEUP    20  // IPI to wake up a halted CPU (see cpuidle)
 #define IRQ_SPURIOUS  31
@@ -68,6 +68,20 @@ static pte_t* walkpgdir ( pde_t* pgdir, const void* vAddr, int alloc )
 	// If the PDE is present, retrieve relevant page table
 	if ( *pde & PDE_P )
 	{
+		/* A superpage (see mapkernpages) has no page table.
+		   Only the kernel's mappings use them, so user
+		   addresses never end up here.
+		*/
+		if ( *pde & PDE_PS )
+		{
+			if ( alloc )
+			{
+				panic( "walkpgdir: superpage" );
+			}
+
+			return 0;
+		}
+
 		pgtab = ( pte_t* ) P2V( PDE_ADDR( *pde ) );
 	}
 
@@ -81,16 +95,14 @@ static pte_t* walkpgdir ( pde_t* pgdir, const void* vAddr, int alloc )
 			return 0;
 		}
 
-		pgtab = ( pte_t* ) kalloc();
+		// Zeroed, make sure all those PTE_P bits are zero.
+		pgtab = ( pte_t* ) kzalloc();
 
 		if ( pgtab == 0 )
 		{
 			return 0;
 		}
 
-		// Make sure all those PTE_P bits are zero.
-		memset( pgtab, 0, PGSIZE );
-
 		// The permissions here are overly generous, but they can
 		// be further restricted by the permissions in the page table
 		// entries, if necessary.
@@ -155,6 +167,69 @@ static int mappages ( pde_t* pgdir, void* vAddr, uint pAddr, uint size, int perm
 	return 0;
 }
 
+/* Like mappages, but maps every part of the range that is
+   4MB aligned (both virtually and physically) and spans a whole
+   4MB with a single superpage PDE instead of a page table.
+   The rest of the range gets regular pages.
+
+   This is used for the kernel's mappings (kmap), most of which
+   is the direct map of physical memory. It saves a page table
+   page per 4MB and lets one TLB entry cover 4MB of kernel memory.
+
+   The user part of a page table always uses regular pages,
+   which walkpgdir, copyuvm, deallocuvm etc. rely on.
+
+   vAddr, pAddr and size must be page-aligned.
+*/
+static int mapkernpages ( pde_t* pgdir, void* vAddr, uint pAddr, uint size, int permissions )
+{
+	uint   a;
+	uint   n;
+	pde_t* pde;
+
+	a = ( uint ) vAddr;
+
+	// Note: 'a' and 'pAddr' can wrap around to 0 at the end of the
+	// DEVSPACE mapping, so loop on the remaining size instead
+	while ( size > 0 )
+	{
+		if ( a % SUPERPGSIZE == 0 && pAddr % SUPERPGSIZE == 0 && size >= SUPERPGSIZE )
+		{
+			pde = &( pgdir[ PD_IDX( a ) ] );
+
+			if ( *pde & PDE_P )
+			{
+				panic( "mapkernpages: remap" );
+			}
+
+			*pde = pAddr | permissions | PDE_P | PDE_PS;
+
+			n = SUPERPGSIZE;
+		}
+		else
+		{
+			// Regular pages up to the next 4MB boundary
+			n = SUPERPGSIZE - ( a % SUPERPGSIZE );
+
+			if ( n > size )
+			{
+				n = size;
+			}
+
+			if ( mappages( pgdir, ( void* ) a, pAddr, n, permissions ) < 0 )
+			{
+				return - 1;
+			}
+		}
+
+		a     += n;
+		pAddr += n;
+		size  -= n;
+	}
+
+	return 0;
+}
+
 
 // _________________________________________________________________________________
 
@@ -176,7 +251,7 @@ static int mappages ( pde_t* pgdir, void* vAddr, uint pAddr, uint size, int perm
      KERNBASE + EXTMEM .. data:
          . kernel's instructions and kernel's r/o data
 
-     data .. P2V(PHYSTOP):
+     data .. P2V(phystop):
          . kernel's rw data and free physical memory
 
      DEVSPACE .. 0xFFFF_FFFF:
@@ -184,8 +259,12 @@ static int mappages ( pde_t* pgdir, void* vAddr, uint pAddr, uint size, int perm
          . mapped directly (virtual address == physical address)
 
    The kernel allocates physical memory for its heap and for user memory
-   between V2P( end ) and the end of physical memory (PHYSTOP)
-   (directly addressable from end..P2V( PHYSTOP )).
+   between V2P( end ) and the end of physical memory (phystop, see e820.c)
+   (directly addressable from end..P2V( phystop )).
+
+   The kernel part is mapped with 4MB superpages wherever possible
+   (see mapkernpages). With the default layout, that is everything
+   from KERNBASE + 4MB to P2V( phystop ), and DEVSPACE.
 */
 
 // This table defines the kernel's mappings, which are present in
@@ -228,15 +307,15 @@ static struct _mmap kmap [] = {
 	/*
 		Virtual range :
 			start : KERNBASE + EXTMEM + sizeof( kernel text and rodata )
-			end   : P2V(PHYSTOP)
+			end   : P2V(phystop)
 		Physical range :
 			start : 0 + EXTMEM + sizeof( kernel text and rodata )
-			end   : PHYSTOP
+			end   : phystop
 	*/
 	{
 		( void* ) data,
 		V2P( data ),
-		PHYSTOP,
+		0,                   // phystop, only known at boot. Set by kvmmap
 		PTE_W
 	},
 
@@ -285,34 +364,21 @@ static struct _mmap umap [] = {
 	}
 };
 
-// Create a page table? and map the kernel part.
-/* Causes all processes' page tables to have identical mappings
-   for kernel code and rodata... 
-   ??
+/* Map the kernel part (KERNBASE..0xFFFF_FFFF) into pgdir.
+   Only done once, for kpgdir. See setupkvm.
 */
-pde_t* setupkvm ( void )
+static int kvmmap ( pde_t* pgdir )
 {
 	struct _mmap* mp;
-	pde_t*        pgdir;
-
-	// Allocate a page of memory to hold the page directory
-	pgdir = ( pde_t* ) kalloc();
-
-	if ( pgdir == 0 )
-	{
-		return 0;
-	}
-
-	// Clear junk
-	memset( pgdir, 0, PGSIZE );
-
 
 	// Check if using region reserved for memory mapped IO
-	if ( P2V( PHYSTOP ) > ( void* ) DEVSPACE )
+	if ( P2V( phystop ) > ( void* ) DEVSPACE )
 	{
-		panic( "setupkvm: PHYSTOP too high" );
+		panic( "kvmmap: phystop too high" );
 	}
 
+	kmap[ 2 ].phys_end = phystop;  // kernel rwdata and free memory
+
 
 	// Map kernel virtual addresses (KERNBASE..0xFFFF_FFFF)
 	for ( mp = kmap; mp < &( kmap[ NELEM( kmap ) ] ); mp += 1 )
@@ -326,25 +392,65 @@ pde_t* setupkvm ( void )
 		);*/
 
 		if (
-			mappages(
+			mapkernpages(
 
 				pgdir,
 				mp->virt_start,                 // virtual start address
 				( uint ) mp->phys_start,        // physical start address
 				mp->phys_end - mp->phys_start,  // size
-				mp->permissions
+				mp->permissions | PTE_G         // see kvmenableglobal
 			) < 0 )
 		{
-			freevm( pgdir );
-
-			return 0;
+			return - 1;
 		}
 	}
 
+	return 0;
+}
+
+// Create a page table? and map the kernel part.
+/* Causes all processes' page tables to have identical mappings
+   for kernel code and rodata...
+
+   The kernel part is identical in every page table, so it is only
+   built once (in kpgdir, by kvmalloc). setupkvm copies kpgdir's
+   kernel PDEs, which means every page directory points to the same
+   kernel page table pages (and superpages). Creating a page table
+   costs one page (the page directory) plus whatever the user part
+   needs, and freevm only frees the user part's page tables.
+
+   This relies on the kernel's mappings never changing after
+   kvmalloc. Anything mapped into the kernel part of a single page
+   directory later would not show up in the others.
+*/
+pde_t* setupkvm ( void )
+{
+	struct _mmap* mp;
+	pde_t*        pgdir;
+
+	// Allocate a (zeroed) page of memory to hold the page directory
+	pgdir = ( pde_t* ) kzalloc();
+
+	if ( pgdir == 0 )
+	{
+		return 0;
+	}
+
+
+	// Share kernel page tables (KERNBASE..0xFFFF_FFFF)
+	memmove(
+
+		&( pgdir[ PD_IDX( KERNBASE ) ] ),
+		&( kpgdir[ PD_IDX( KERNBASE ) ] ),
+		( NPDENTRIES - PD_IDX( KERNBASE ) ) * sizeof( pde_t )
+	);
+
 
 	/* JK...
 	   Map user IO virtual addresses (USER_MMIO_BASE..KERNBASE).
 	   Over here for convenience... can be separate function.
+	   These are below KERNBASE so each page directory gets
+	   its own page table for them.
 	*/
 	for ( mp = umap; mp < &( umap[ NELEM( umap ) ] ); mp += 1 )
 	{
@@ -377,6 +483,22 @@ pde_t* setupkvm ( void )
 }
 
 
+/* The kernel's mappings are the same in every page table (see setupkvm)
+   so there is no need for the TLB to throw them away every time %cr3 is
+   loaded (i.e. on every context switch). kvmmap marks them global
+   (PTE_G), and this turns on global pages (CR4_PGE) for this CPU.
+   After that, loading %cr3 only flushes user TLB entries.
+
+   Global entries are never flushed by a %cr3 load, so this relies on
+   the kernel's mappings never changing after kvmalloc.
+   Run once on each CPU, after it switches to kpgdir.
+*/
+void kvmenableglobal ( void )
+{
+	lcr4( rcr4() | CR4_PGE );
+}
+
+
 // _________________________________________________________________________________
 
 // Switch h/w page table register to the kernel-only page table,
@@ -420,7 +542,7 @@ void switchuvm ( struct proc* p )
 		panic( "switchuvm: no kstack" );
 	}
 
-	if ( p->pgdir == 0 )
+	if ( p->vm == 0 || p->vm->pgdir == 0 )
 	{
 		panic( "switchuvm: no pgdir" );
 	}
@@ -461,7 +583,10 @@ void switchuvm ( struct proc* p )
 
 
 	// Switch to the process's page table...
-	lcr3( V2P( p->pgdir ) );
+	lcr3( V2P( p->vm->pgdir ) );
+
+	mycpu()->pgdir  = p->vm->pgdir;
+	mycpu()->ncr3  += 1;
 
 
 	// ?
@@ -474,9 +599,24 @@ void switchuvm ( struct proc* p )
 // Allocate one page table for the machine for the kernel address
 // space for scheduler processes.
 // ??
+/* This is the only place the kernel part of a page table is
+   built. Every other page table shares it (see setupkvm).
+*/
 void kvmalloc ( void )
 {
-	kpgdir = setupkvm();
+	kpgdir = ( pde_t* ) kalloc();
+
+	if ( kpgdir == 0 )
+	{
+		panic( "kvmalloc: out of memory" );
+	}
+
+	memset( kpgdir, 0, PGSIZE );
+
+	if ( kvmmap( kpgdir ) < 0 )
+	{
+		panic( "kvmalloc: out of memory" );
+	}
 
 	switchkvm();
 }
@@ -498,11 +638,8 @@ void inituvm ( pde_t* pgdir, char* init, uint sz )
 		panic( "inituvm: more than a page" );
 	}
 
-	// Allocate one page of physical memory
-	mem = kalloc();
-
-	// Clear junk from the page
-	memset( mem, 0, PGSIZE );
+	// Allocate one (zeroed) page of physical memory
+	mem = kzalloc();
 
 	// Map virtual address 0 to the page's physical address
 	mappages(
@@ -607,28 +744,38 @@ pde_t* copyuvm ( pde_t* pgdir, uint sz )
 			panic( "copyuvm: pte should exist" );
 		}
 
-		if ( ! ( *pte & PTE_P ) )
+		if ( ! ( *pte & PTE_P ) && ! ( *pte & PTE_SWAPPED ) )
 		{
 			panic( "copyuvm: page not present" );
 		}
 
-		pAddr = PTE_ADDR(  *pte );
-		flags = PTE_FLAGS( *pte );  /* To implement copy on write, would change to
-		                               read only (clear PTE_W) for both parent and child
-		                               so that when either process attempts to write
-		                               to the page, the CPU triggers a page fault.
-		                               In the handler, the kernel duplicates the page and
-		                               marks it R/W for the writing?/both? process/es...
-		                               https://manybutfinite.com/post/cpu-rings-privilege-and-protection/ */
-
-		mem = kalloc();
+		mem = ukalloc();
 
 		if ( mem == 0 )
 		{
 			goto bad;
 		}
 
-		memmove( mem, ( char* ) P2V( pAddr ), PGSIZE );
+		// Swapped out, copy straight from swap into the child's page
+		if ( *pte & PTE_SWAPPED )
+		{
+			swapread( PTE_ADDR( *pte ) >> PT_IDX_SHIFT, mem );
+
+			flags = ( PTE_FLAGS( *pte ) & ~ PTE_SWAPPED ) | PTE_P;
+		}
+		else
+		{
+			pAddr = PTE_ADDR(  *pte );
+			flags = PTE_FLAGS( *pte );  /* To implement copy on write, would change to
+			                               read only (clear PTE_W) for both parent and child
+			                               so that when either process attempts to write
+			                               to the page, the CPU triggers a page fault.
+			                               In the handler, the kernel duplicates the page and
+			                               marks it R/W for the writing?/both? process/es...
+			                               https://manybutfinite.com/post/cpu-rings-privilege-and-protection/ */
+
+			memmove( mem, ( char* ) P2V( pAddr ), PGSIZE );
+		}
 
 		if (
 			mappages(
@@ -654,6 +801,13 @@ pde_t* copyuvm ( pde_t* pgdir, uint sz )
 	}*/
 
 
+	// Share parent's shared memory segments with child
+	if ( shmfork( pgdir, newPgdir ) < 0 )
+	{
+		goto bad;
+	}
+
+
 	//
 	return newPgdir;
 
@@ -682,7 +836,8 @@ int allocuvm ( pde_t* pgdir, uint oldsz, uint newsz )
 
 	// Upper limit
 	// if ( newsz >= KERNBASE )
-	if ( newsz >= USER_MMIO_BASE )
+	// if ( newsz >= USER_MMIO_BASE )
+	if ( newsz >= SHM_BASE )
 	{
 		return 0;
 	}
@@ -697,7 +852,14 @@ int allocuvm ( pde_t* pgdir, uint oldsz, uint newsz )
 
 	for ( ; a < newsz; a += PGSIZE )
 	{
-		mem = kalloc();
+		// Zeroed memory
+		/* Why?
+		    . clean garbage
+		    . C assumes that unitialized statics (BSS section)
+		      have a value of zero...
+		    . security (can't read another process's old data)
+		*/
+		mem = ukzalloc();  // may swap out other pages
 
 		if ( mem == 0 )
 		{
@@ -708,15 +870,6 @@ int allocuvm ( pde_t* pgdir, uint oldsz, uint newsz )
 			return 0;
 		}
 
-		// Zero the memory
-		/* Why?
-		    . clean garbage
-		    . C assumes that unitialized statics (BSS section)
-		      have a value of zero...
-		    . security (can't read another process's old data)
-		*/
-		memset( mem, 0, PGSIZE );
-
 		// ...
 		if (
 			mappages(
@@ -776,6 +929,18 @@ int deallocuvm ( pde_t* pgdir, uint oldsz, uint newsz )
 		{
 			a = PGADDR( PD_IDX( a ) + 1, 0, 0 ) - PGSIZE;
 		}
+		// Shared memory pages are owned by shm.c, just unmap
+		else if ( ( *pte & PTE_P ) && ( *pte & PTE_SHARED ) )
+		{
+			*pte = 0;
+		}
+		// Swapped out, free the swap slot
+		else if ( *pte & PTE_SWAPPED )
+		{
+			swapfree( PTE_ADDR( *pte ) >> PT_IDX_SHIFT );
+
+			*pte = 0;
+		}
 		// Free corresponding physical page...
 		else if ( ( *pte & PTE_P ) != 0 )
 		{
@@ -813,13 +978,17 @@ void freevm ( pde_t* pgdir )
 	}
 
 
+	// Detach shared memory segments
+	shmrelease( pgdir );
+
 	// Free memory pointed to by page table
 	// deallocuvm( pgdir, KERNBASE, 0 );  // region 0..KERNBASE
 	deallocuvm( pgdir, USER_MMIO_BASE, 0 );  // region 0..USER_MMIO_BASE
 
 
 	// Free memory used by page table
-	for ( i = 0; i < NPDENTRIES; i += 1 )
+	// Only the user part. The kernel part is shared with kpgdir (see setupkvm)
+	for ( i = 0; i < PD_IDX( KERNBASE ); i += 1 )
 	{
 		if ( pgdir[ i ] & PDE_P )
 		{
@@ -833,6 +1002,189 @@ void freevm ( pde_t* pgdir )
 }
 
 
+// _________________________________________________________________________________
+
+/* Map the shared memory pages 'pages[0..npages)' at virtual address
+   vAddr. The pages are marked PTE_SHARED, so deallocuvm and freevm
+   leave freeing them to shm.c
+*/
+int mapshared ( pde_t* pgdir, uint vAddr, char** pages, uint npages )
+{
+	uint i;
+
+	for ( i = 0; i < npages; i += 1 )
+	{
+		if (
+			mappages(
+
+				pgdir,
+				( char* ) ( vAddr + i * PGSIZE ),  // virtual start address
+				V2P( pages[ i ] ),                 // physical start address
+				PGSIZE,                            // size
+				PTE_W | PTE_U | PTE_SHARED
+			) < 0 )
+		{
+			unmapshared( pgdir, vAddr, i );
+
+			return - 1;
+		}
+	}
+
+	return 0;
+}
+
+// Remove the mappings created by mapshared. Does not free the pages.
+void unmapshared ( pde_t* pgdir, uint vAddr, uint npages )
+{
+	pte_t* pte;
+	uint   i;
+
+	for ( i = 0; i < npages; i += 1 )
+	{
+		pte = walkpgdir( pgdir, ( char* ) ( vAddr + i * PGSIZE ), 0 );
+
+		if ( pte == 0 || ( *pte & PTE_SHARED ) == 0 )
+		{
+			panic( "unmapshared" );
+		}
+
+		*pte = 0;
+	}
+}
+
+// Is vAddr mapped to a shared memory page?
+int isshared ( pde_t* pgdir, uint vAddr )
+{
+	pte_t* pte;
+
+	pte = walkpgdir( pgdir, ( char* ) vAddr, 0 );
+
+	return pte != 0 && ( *pte & PTE_P ) && ( *pte & PTE_SHARED );
+}
+
+
+// _________________________________________________________________________________
+
+/* Swap out one page of the user memory [*vAddr, sz) mapped by
+   pgdir to swap slot 'slot', and free the page.
+   This is the clock (second chance) part of swap.c's reclaim:
+   pages that have been accessed since the last time the clock
+   hand passed (PTE_A set) are skipped, and their PTE_A cleared.
+   Shared memory and other non-user pages are never swapped.
+
+   On return, *vAddr is where the clock hand stopped.
+   Returns 0 if a page was swapped out, -1 if the hand reached sz.
+
+   The caller must make sure that nobody uses or changes these
+   mappings meanwhile, and must flush the TLB if pgdir is loaded.
+*/
+int swapoutpage ( pde_t* pgdir, uint sz, uint* vAddr, int slot )
+{
+	pte_t* pte;
+	uint   a;
+	char*  page;
+
+	for ( a = PGROUNDDOWN( *vAddr ); a < sz; a += PGSIZE )
+	{
+		pte = walkpgdir( pgdir, ( char* ) a, 0 );
+
+		if ( pte == 0                 ||
+		     ( *pte & PTE_P ) == 0    ||
+		     ( *pte & PTE_U ) == 0    ||  // ex. stack guard page
+		     ( *pte & PTE_SHARED ) )
+		{
+			continue;
+		}
+
+		// Used recently, give it a second chance
+		if ( *pte & PTE_A )
+		{
+			*pte &= ~ PTE_A;
+
+			continue;
+		}
+
+		page = P2V( PTE_ADDR( *pte ) );
+
+		swapwrite( slot, page );
+
+		*pte = ( slot << PT_IDX_SHIFT ) | ( PTE_FLAGS( *pte ) & ~ PTE_P ) | PTE_SWAPPED;
+
+		kfree( page );
+
+		*vAddr = a + PGSIZE;
+
+		return 0;
+	}
+
+	*vAddr = a;
+
+	return - 1;
+}
+
+/* Bring the swapped out page at vAddr back into memory.
+   Returns -1 if the page is not swapped out, or there is
+   no memory for it.
+*/
+int swapinpage ( pde_t* pgdir, uint vAddr )
+{
+	pte_t* pte;
+	char*  mem;
+	uint   slot;
+
+	pte = walkpgdir( pgdir, ( char* ) PGROUNDDOWN( vAddr ), 0 );
+
+	if ( pte == 0 || ( *pte & PTE_SWAPPED ) == 0 )
+	{
+		return - 1;
+	}
+
+	mem = ukalloc();  // may sleep, read the PTE after
+
+	if ( mem == 0 )
+	{
+		return - 1;
+	}
+
+	slot = PTE_ADDR( *pte ) >> PT_IDX_SHIFT;
+
+	swapread( slot, mem );
+
+	*pte = V2P( mem ) | ( PTE_FLAGS( *pte ) & ~ PTE_SWAPPED ) | PTE_P;
+
+	swapfree( slot );
+
+	return 0;
+}
+
+/* Make sure none of the pages in [vAddr, vAddr + size) are
+   swapped out. Used before the kernel reads or writes user
+   memory directly, ex. for system call arguments.
+*/
+int swapinrange ( pde_t* pgdir, uint vAddr, uint size )
+{
+	pte_t* pte;
+	uint   a;
+
+	if ( size == 0 )
+	{
+		return 0;
+	}
+
+	for ( a = PGROUNDDOWN( vAddr ); a < vAddr + size; a += PGSIZE )
+	{
+		pte = walkpgdir( pgdir, ( char* ) a, 0 );
+
+		if ( pte && ( *pte & PTE_SWAPPED ) && swapinpage( pgdir, a ) < 0 )
+		{
+			return - 1;
+		}
+	}
+
+	return 0;
+}
+
+
 // _________________________________________________________________________________
 
 // Clear PTE_U on a page. Used to create an inaccessible
@@ -859,13 +1211,13 @@ void clearpteu ( pde_t* pgdir, char* uva )
 /* Check that virtual address is mapped to user space.
    If it is, return address of the associated physical page.
 */
-static char* userVAddrToPhysAddr ( pde_t* pgdir, char* vAddr )
+char* userVAddrToPhysAddr ( pde_t* pgdir, char* vAddr )
 {
 	pte_t* pte;
 
 	pte = walkpgdir( pgdir, vAddr, 0 );
 
-	if ( ( *pte & PTE_P ) == 0 )
+	if ( pte == 0 || ( *pte & PTE_P ) == 0 )
 	{
 		return 0;
 	}
@@ -121,6 +121,16 @@ static inline void sti ( void )
 	asm volatile( "sti" );
 }
 
+/* Enable interrupts and halt until one arrives.
+   sti only takes effect after the next instruction, so an interrupt
+   can't sneak in between the two and leave us halted with the
+   work it brought waiting.
+*/
+static inline void stihlt ( void )
+{
+	asm volatile( "sti; hlt" );
+}
+
 
 // ________________________________________________________________________
 
@@ -177,6 +187,25 @@ static inline void lcr3 ( uint val )
 	asm volatile( "movl %0, %%cr3" : : "r" ( val ) );
 }
 
+// Read CR4 control register
+static inline uint rcr4 ( void )
+{
+	uint val;
+
+	asm volatile( "movl %%cr4, %0" : "=r" ( val ) );
+
+	return val;
+}
+
+// Write CR4 control register
+/* Enables extensions such as 4MB pages (CR4_PSE) and
+   global pages (CR4_PGE)...
+*/
+static inline void lcr4 ( uint val )
+{
+	asm volatile( "movl %0, %%cr4" : : "r" ( val ) );
+}
+
 
 // ________________________________________________________________________
 
@@ -27,7 +27,7 @@
 
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map | data blocks | swap area ]
 // 1 fs block equals 1 disk sector
 
 int nlogblocks,     // Number of log blocks 
@@ -141,6 +141,8 @@ int main ( int argc, char* argv [] )
 	sb.logstart    = xint( 2 );
 	sb.inodestart  = xint( 2 + nlogblocks );
 	sb.bmapstart   = xint( 2 + nlogblocks + ninodeblocks );
+	sb.swapstart   = xint( FSSIZE );
+	sb.nswapblocks = xint( SWAPSIZE );
 
 	printf(
 
@@ -151,10 +153,11 @@ int main ( int argc, char* argv [] )
 		"    inode blocks  %u\n"
 		"    bitmap blocks %u\n"
 		"data blocks  %d\n"
-		"total blocks %d\n\n",
+		"total blocks %d\n"
+		"swap blocks  %d\n\n",
 
 		nmeta, nlogblocks, ninodeblocks, nbitmapblocks,
-		ndatablocks, FSSIZE 
+		ndatablocks, FSSIZE, SWAPSIZE
 	);
 
 	// the first free block that we can allocate
@@ -167,7 +170,8 @@ int main ( int argc, char* argv [] )
 
 
 	// Write zeroes to entire fs ??
-	for ( i = 0; i < FSSIZE; i += 1 )
+	// (and swap area, so that the image is big enough to hold it)
+	for ( i = 0; i < FSSIZE + SWAPSIZE; i += 1 )
 	{
 		wsect( i, zeroes );
 	}
@@ -478,7 +482,7 @@ void addDirectory ( int dir_inum, char* localdirname )
 
 void wsect ( uint sec, void* buf )
 {
-	if ( ( sec < 0 ) || ( sec >= FSSIZE ) )
+	if ( ( sec < 0 ) || ( sec >= FSSIZE + SWAPSIZE ) )
 	{
 		fprintf( stderr, "wsect: invalid sector number - %d\n", sec );
 
@@ -502,7 +506,7 @@ void wsect ( uint sec, void* buf )
 
 void rsect ( uint sec, void* buf )
 {
-	if ( ( sec < 0 ) || ( sec >= FSSIZE ) )
+	if ( ( sec < 0 ) || ( sec >= FSSIZE + SWAPSIZE ) )
 	{
 		fprintf( stderr, "rsect: invalid sector number - %d\n", sec );
 
@@ -0,0 +1,25 @@
+// Mutexes and condition variables for threads (see ulock.c)
+
+struct mutex
+{
+	volatile int state;  // 0 unlocked, 1 locked, 2 locked and maybe waiters
+};
+
+struct cond
+{
+	volatile int seq;    // bumped on every signal/broadcast
+};
+
+#define MUTEX_INITIALIZER { 0 }
+#define COND_INITIALIZER  { 0 }
+
+
+void mutex_init    ( struct mutex* );
+void mutex_lock    ( struct mutex* );
+int  mutex_trylock ( struct mutex* );
+void mutex_unlock  ( struct mutex* );
+
+void cond_init      ( struct cond* );
+void cond_wait      ( struct cond*, struct mutex* );
+void cond_signal    ( struct cond* );
+void cond_broadcast ( struct cond* );
@@ -2,6 +2,8 @@
 
 struct stat;
 struct rtcdate;
+struct rusage;
+struct procinfo;
 
 // system calls
 int   chdir   ( const char* );
@@ -28,6 +30,19 @@ int   unlink  ( const char* );
 int   uptime  ( void );
 int   wait    ( void );
 int   write   ( int, const void*, int );
+int   shmget  ( int, uint );
+char* shmat   ( int );
+int   shmdt   ( void* );
+int   nice    ( int );
+int   setpriority ( int, int );
+int   setaffinity ( int, uint );
+uint  getaffinity ( int );
+int   clone   ( void* );
+int   join    ( void** );
+int   futexwait ( int*, int );
+int   futexwake ( int*, int );
+int   getrusage ( int, struct rusage* );
+int   getprocs  ( struct procinfo*, int );
 
 // printf.c
 int printf    ( int, const char*, ... );
@@ -0,0 +1,24 @@
+// Threads and a work-stealing task pool (see uthread.c)
+
+#define UTHREAD_STACKSIZE  ( 4 * 4096 )  // bytes, a multiple of the page size
+#define POOL_MAXWORKERS    8
+#define POOL_DEQUESIZE     64            // tasks queued per worker
+
+struct uthread;
+
+int   thread_create ( struct uthread**, void* ( * ) ( void* ), void* );
+int   thread_join   ( struct uthread*, void** );
+int   thread_ncpu   ( void );
+
+char* stack_alloc   ( void );
+void  stack_free    ( char* );
+
+
+// __________________________________________________________________________
+
+struct pool;
+
+struct pool* pool_create  ( int );
+void         pool_destroy ( struct pool* );
+void         pool_submit  ( struct pool*, void ( * ) ( void* ), void* );
+void         pool_wait    ( struct pool* );
@@ -0,0 +1,162 @@
+// Mutexes and condition variables
+
+/* Built on the futexwait/futexwake system calls (see kernel/futex.c).
+   Taking a free mutex and releasing a mutex nobody waits on are a
+   single atomic instruction each, and never enter the kernel.
+
+   Mutex (from Drepper's "Futexes Are Tricky"), 'state' is
+     . 0 - unlocked
+     . 1 - locked, nobody waiting
+     . 2 - locked, maybe somebody waiting
+   A thread that finds the mutex locked sets the state to 2 and
+   sleeps until it changes. Unlocking a mutex in state 2 wakes up
+   one waiter. Waking is the only time unlock enters the kernel.
+
+   Condition variable:
+     'seq' is bumped on every signal. cond_wait reads it before
+     releasing the mutex, and sleeps only if it hasn't changed since,
+     so a signal between unlocking and sleeping isn't lost.
+     As with sleep in the kernel, waits must be wrapped in a loop
+     that rechecks the condition.
+*/
+
+#include "kernel/types.h"
+#include "user.h"
+#include "ulock.h"
+
+
+// Atomically set *addr to 'val', and return its old value
+static inline int xchg ( volatile int* addr, int val )
+{
+	int old;
+
+	asm volatile(
+
+		"lock; xchgl %0, %1"
+		: "+m" ( *addr ), "=a" ( old )
+		: "1" ( val )
+		: "memory"
+	);
+
+	return old;
+}
+
+// If *addr is 'expected' set it to 'val'. Returns the old value
+static inline int cmpxchg ( volatile int* addr, int expected, int val )
+{
+	int old;
+
+	asm volatile(
+
+		"lock; cmpxchgl %2, %1"
+		: "=a" ( old ), "+m" ( *addr )
+		: "r" ( val ), "0" ( expected )
+		: "memory"
+	);
+
+	return old;
+}
+
+// Atomically add 'val' to *addr
+static inline void atomicadd ( volatile int* addr, int val )
+{
+	asm volatile(
+
+		"lock; addl %1, %0"
+		: "+m" ( *addr )
+		: "ir" ( val )
+		: "memory"
+	);
+}
+
+
+// __________________________________________________________________________
+
+void mutex_init ( struct mutex* m )
+{
+	m->state = 0;
+}
+
+void mutex_lock ( struct mutex* m )
+{
+	int c;
+
+	// Fast path, mutex was free
+	c = cmpxchg( &m->state, 0, 1 );
+
+	if ( c == 0 )
+	{
+		return;
+	}
+
+	/* Mark it contended, and wait until we are the ones that
+	   swap it from unlocked. We can't tell whether anybody else
+	   is still waiting, so we take it in state 2 to be safe.
+	*/
+	if ( c != 2 )
+	{
+		c = xchg( &m->state, 2 );
+	}
+
+	while ( c != 0 )
+	{
+		futexwait( ( int* ) &m->state, 2 );
+
+		c = xchg( &m->state, 2 );
+	}
+}
+
+// Returns 0 if the mutex was taken, -1 if it is locked
+int mutex_trylock ( struct mutex* m )
+{
+	return cmpxchg( &m->state, 0, 1 ) == 0 ? 0 : - 1;
+}
+
+void mutex_unlock ( struct mutex* m )
+{
+	if ( xchg( &m->state, 0 ) == 2 )
+	{
+		futexwake( ( int* ) &m->state, 1 );
+	}
+}
+
+
+// __________________________________________________________________________
+
+void cond_init ( struct cond* c )
+{
+	c->seq = 0;
+}
+
+void cond_wait ( struct cond* c, struct mutex* m )
+{
+	int seq;
+
+	seq = c->seq;
+
+	mutex_unlock( m );
+
+	futexwait( ( int* ) &c->seq, seq );
+
+	/* Take the mutex in state 2, as other waiters may have been
+	   woken up with us (broadcast) and be waiting for it
+	*/
+	while ( xchg( &m->state, 2 ) != 0 )
+	{
+		futexwait( ( int* ) &m->state, 2 );
+	}
+}
+
+void cond_signal ( struct cond* c )
+{
+	atomicadd( &c->seq, 1 );
+
+	futexwake( ( int* ) &c->seq, 1 );
+}
+
+void cond_broadcast ( struct cond* c )
+{
+	atomicadd( &c->seq, 1 );
+
+	futexwake( ( int* ) &c->seq, 0x7fffffff );
+}
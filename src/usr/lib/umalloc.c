@@ -7,6 +7,7 @@
 #include "kernel/param.h"
 #include "kernel/mmu.h"
 #include "user.h"
+#include "ulock.h"
 
 /*
 	. The space malloc manages may not be contiguous. Thus its
@@ -93,9 +94,16 @@ static Header base;  // initial block of the free list
 
 static Header* freelistPtr = NULL;  // pointer to a block in the free list
 
+/* Threads (see uthread.c) share the heap, so the free list is
+   protected by a mutex. Uncontended, as in programs without
+   threads, taking it costs an atomic instruction and no system
+   call (see ulock.c).
+*/
+static struct mutex heapLock = MUTEX_INITIALIZER;
+
 
-static int morecore ( uint );
-void       free     ( void* );
+static int  morecore  ( uint );
+static void freeBlock ( void* );
 
 /* Return ceiling of x/y integer division
    stackoverflow.com/a/503201
@@ -106,8 +114,9 @@ static int ceilingDivide ( int x, int y )
 }
 
 /* See annotations at stackoverflow.com/a/36512105
+   Caller must hold heapLock.
 */
-void* malloc ( uint nbytes )
+static void* allocBlock ( uint nbytes )
 {
 	Header* blockPtr;
 	Header* prevBlockPtr;
@@ -238,9 +247,9 @@ static int morecore ( uint nunits )
 
 
 	/* Insert the block into the free list.
-	   +1 because free() expects pointer to block's free space.
+	   +1 because freeBlock() expects pointer to block's free space.
 	*/
-	free( ( void* ) ( headerPtr + 1 ) );
+	freeBlock( ( void* ) ( headerPtr + 1 ) );
 
 
 	//
@@ -255,8 +264,9 @@ static int morecore ( uint nunits )
    'free' does not zero its contents.
    Thus blocks returned by malloc should be treated as
    containing garbage data.
+   Caller must hold heapLock.
 */
-void free ( void* blockFreeSpacePtr )
+static void freeBlock ( void* blockFreeSpacePtr )
 {
 	Header* blockPtr;
 	Header* curBlockPtr;
@@ -344,6 +354,28 @@ void free ( void* blockFreeSpacePtr )
 	freelistPtr = curBlockPtr;
 }
 
+void* malloc ( uint nbytes )
+{
+	void* p;
+
+	mutex_lock( &heapLock );
+
+	p = allocBlock( nbytes );
+
+	mutex_unlock( &heapLock );
+
+	return p;
+}
+
+void free ( void* blockFreeSpacePtr )
+{
+	mutex_lock( &heapLock );
+
+	freeBlock( blockFreeSpacePtr );
+
+	mutex_unlock( &heapLock );
+}
+
 
 // ___________________________________________________________________________________
 
@@ -0,0 +1,637 @@
+// Threads and a work-stealing task pool
+
+/* Threads:
+     Built on the clone and join system calls (see kernel/proc.c).
+     thread_create runs fn( arg ) in a new thread, on a stack from
+     stack_alloc. The thread's return value is collected by
+     thread_join, which must be called by the thread that created
+     it (join only reaps the caller's own threads).
+
+     clone continues the new thread on a copy of the caller's
+     current stack page. Rather than rely on that (the caller's
+     frame may straddle a page boundary), 'spawn' calls clone
+     directly, and the new thread immediately moves to the top of
+     its own, empty, stack and calls threadstart.
+
+   Stacks:
+     UTHREAD_STACKSIZE bytes, page aligned, carved from sbrk.
+     Freed stacks are kept on a free list for the next thread,
+     memory is never given back (threads can't shrink the address
+     space anyway, see growproc).
+
+   Task pool:
+     A fixed set of worker threads runs tasks, fn( arg ). Each
+     worker has its own deque of tasks:
+       . a worker pushes and pops tasks at the tail of its own
+         deque (newest first, its data is likely still in cache)
+       . a worker whose deque is empty steals from the head of
+         another worker's deque (oldest first, likely the biggest
+         piece of remaining work)
+     Tasks submitted by a task go to its worker's deque, tasks
+     submitted from outside are spread across the deques round
+     robin. Workers with nothing to do or steal sleep on a
+     condition variable.
+
+     Each deque has its own mutex, so workers only contend with
+     each other when stealing.
+*/
+
+#include "kernel/types.h"
+#include "kernel/syscall.h"
+#include "kernel/trap.h"
+#include "user.h"
+#include "ulock.h"
+#include "uthread.h"
+
+#define PGSIZE 4096
+
+
+struct uthread
+{
+	void*           ( *fn ) ( void* );
+	void*           arg;
+	void*           ret;       // fn's return value
+
+	char*           stack;     // lowest address of the stack
+	int             pid;
+	int             exited;    // reaped by join
+
+	struct uthread* next;      // in 'threads'
+};
+
+static struct mutex    threadlock = MUTEX_INITIALIZER;  // protects 'threads'
+static struct uthread* threads;
+
+static struct mutex    stacklock = MUTEX_INITIALIZER;   // protects 'freestacks'
+static char*           freestacks;                      // linked through first word
+
+
+// __________________________________________________________________________
+
+// Returns 0 if out of memory
+char* stack_alloc ( void )
+{
+	char* stack;
+	char* mem;
+
+	mutex_lock( &stacklock );
+
+	stack = freestacks;
+
+	if ( stack != 0 )
+	{
+		freestacks = *( ( char** ) stack );
+
+		mutex_unlock( &stacklock );
+
+		return stack;
+	}
+
+	mutex_unlock( &stacklock );
+
+	// Extra page so that we can align it
+	mem = sbrk( UTHREAD_STACKSIZE + PGSIZE );
+
+	if ( mem == ( char* ) - 1 )
+	{
+		return 0;
+	}
+
+	return ( char* ) ( ( ( uint ) mem + PGSIZE - 1 ) & ~ ( PGSIZE - 1 ) );
+}
+
+void stack_free ( char* stack )
+{
+	mutex_lock( &stacklock );
+
+	*( ( char** ) stack ) = freestacks;
+
+	freestacks = stack;
+
+	mutex_unlock( &stacklock );
+}
+
+
+// __________________________________________________________________________
+
+// First (and last) function on a new thread's stack
+static void __attribute__ ( ( used, noreturn ) ) threadstart ( struct uthread* t )
+{
+	t->ret = t->fn( t->arg );
+
+	exit();
+}
+
+/* clone, with the new thread moving to the top of t->stack and
+   calling threadstart( t ). Returns the thread's pid, or -1.
+*/
+static int spawn ( struct uthread* t )
+{
+	char* top;
+	char* page;
+	int   pid;
+
+	top  = t->stack + UTHREAD_STACKSIZE;
+	page = top - PGSIZE;  // for clone's copy of our stack page
+
+	asm volatile(
+
+		"pushl %2\n\t"             // clone's argument
+		"pushl $0\n\t"             // fake return address (see usys.S)
+		"movl  %4, %%eax\n\t"
+		"int   %5\n\t"
+		"addl  $8, %%esp\n\t"
+		"testl %%eax, %%eax\n\t"
+		"jnz   1f\n\t"
+
+		// Thread (registers other than %eax are the same as ours)
+		"movl  %1, %%esp\n\t"
+		"xorl  %%ebp, %%ebp\n\t"   // end of the call stack, for debuggers
+		"pushl %3\n\t"
+		"call  threadstart\n"
+
+		"1:"
+
+		: "=&a" ( pid )
+		: "r" ( top ), "r" ( page ), "r" ( t ), "i" ( SYS_clone ), "i" ( T_SYSCALL )
+		: "memory", "cc"
+	);
+
+	return pid;
+}
+
+/* Run fn( arg ) in a new thread. On success, sets *tp to the thread
+   (for thread_join) and returns its pid. Returns -1 on failure.
+*/
+int thread_create ( struct uthread** tp, void* ( *fn ) ( void* ), void* arg )
+{
+	struct uthread* t;
+
+	t = malloc( sizeof( struct uthread ) );
+
+	if ( t == 0 )
+	{
+		return - 1;
+	}
+
+	t->fn     = fn;
+	t->arg    = arg;
+	t->ret    = 0;
+	t->exited = 0;
+	t->stack  = stack_alloc();
+
+	if ( t->stack == 0 )
+	{
+		free( t );
+
+		return - 1;
+	}
+
+	// Before spawning, so that a join in another thread can find it
+	mutex_lock( &threadlock );
+
+	t->pid   = - 1;
+	t->next  = threads;
+	threads  = t;
+
+	t->pid = spawn( t );
+
+	mutex_unlock( &threadlock );
+
+	if ( t->pid < 0 )
+	{
+		thread_join( t, 0 );  // just unlinks and frees it
+
+		return - 1;
+	}
+
+	*tp = t;
+
+	return t->pid;
+}
+
+/* Wait for thread t to finish, and free it. If 'ret' is not 0,
+   sets *ret to the value its function returned.
+   Returns 0, or -1 if t is not a thread of the caller.
+*/
+int thread_join ( struct uthread* t, void** ret )
+{
+	struct uthread*  u;
+	struct uthread** pp;
+	int              pid;
+
+	/* join returns whichever of our threads exits first, note
+	   which one it was until its own thread_join comes
+	*/
+	while ( ! t->exited && t->pid >= 0 )
+	{
+		pid = join( 0 );
+
+		if ( pid < 0 )
+		{
+			return - 1;
+		}
+
+		mutex_lock( &threadlock );
+
+		for ( u = threads; u != 0; u = u->next )
+		{
+			if ( u->pid == pid )
+			{
+				u->exited = 1;
+
+				break;
+			}
+		}
+
+		mutex_unlock( &threadlock );
+	}
+
+	mutex_lock( &threadlock );
+
+	for ( pp = &threads; *pp != t; pp = &( *pp )->next )
+	{
+		;
+	}
+
+	*pp = t->next;
+
+	mutex_unlock( &threadlock );
+
+	if ( ret != 0 )
+	{
+		*ret = t->ret;
+	}
+
+	stack_free( t->stack );
+
+	free( t );
+
+	return 0;
+}
+
+// Number of CPUs we may run on (see setaffinity)
+int thread_ncpu ( void )
+{
+	uint mask;
+	int  n;
+
+	mask = getaffinity( 0 );
+
+	for ( n = 0; mask != 0; mask >>= 1 )
+	{
+		n += mask & 1;
+	}
+
+	return n > 0 ? n : 1;
+}
+
+
+// __________________________________________________________________________
+
+struct task
+{
+	void ( *fn ) ( void* );
+	void* arg;
+};
+
+struct deque
+{
+	struct mutex lock;
+	int          head;                        // oldest task
+	int          n;                           // number of tasks
+	struct task  tasks [ POOL_DEQUESIZE ];
+
+	struct pool* pool;                        // for the worker's thread
+	int          id;
+};
+
+struct pool
+{
+	int             nworkers;
+	struct uthread* workers [ POOL_MAXWORKERS ];
+	struct deque    deques  [ POOL_MAXWORKERS ];
+	int             next;                     // deque for the next outside submit
+
+	struct mutex    lock;                     // protects the rest
+	struct cond     work;                     // signalled when a task is queued
+	struct cond     idle;                     // broadcast when nunfinished drops to 0
+	int             nqueued;                  // tasks in the deques
+	int             nunfinished;              // tasks submitted and not done yet
+	int             stop;
+};
+
+
+// Add a task at the tail. Returns -1 if the deque is full
+static int dqpush ( struct deque* dq, struct task* t )
+{
+	mutex_lock( &dq->lock );
+
+	if ( dq->n == POOL_DEQUESIZE )
+	{
+		mutex_unlock( &dq->lock );
+
+		return - 1;
+	}
+
+	dq->tasks[ ( dq->head + dq->n ) % POOL_DEQUESIZE ] = *t;
+
+	dq->n += 1;
+
+	mutex_unlock( &dq->lock );
+
+	return 0;
+}
+
+/* Take a task from the tail (owner) or head (thief).
+   Returns -1 if the deque is empty.
+*/
+static int dqtake ( struct deque* dq, struct task* t, int steal )
+{
+	mutex_lock( &dq->lock );
+
+	if ( dq->n == 0 )
+	{
+		mutex_unlock( &dq->lock );
+
+		return - 1;
+	}
+
+	dq->n -= 1;
+
+	if ( steal )
+	{
+		*t = dq->tasks[ dq->head ];
+
+		dq->head = ( dq->head + 1 ) % POOL_DEQUESIZE;
+	}
+	else
+	{
+		*t = dq->tasks[ ( dq->head + dq->n ) % POOL_DEQUESIZE ];
+	}
+
+	mutex_unlock( &dq->lock );
+
+	return 0;
+}
+
+// Deque of the worker we're running on, -1 if not a worker
+static int poolself ( struct pool* pool )
+{
+	struct uthread* w;
+	char*           sp;
+	int             i;
+
+	asm volatile( "movl %%esp, %0" : "=r" ( sp ) );
+
+	for ( i = 0; i < pool->nworkers; i += 1 )
+	{
+		w = pool->workers[ i ];
+
+		if ( w != 0 && sp >= w->stack && sp < w->stack + UTHREAD_STACKSIZE )
+		{
+			return i;
+		}
+	}
+
+	return - 1;
+}
+
+// Find a task, our own first. Returns -1 if there is none
+static int pooltake ( struct pool* pool, int me, struct task* t )
+{
+	int i;
+
+	if ( dqtake( &pool->deques[ me ], t, 0 ) < 0 )
+	{
+		for ( i = 1; i < pool->nworkers; i += 1 )
+		{
+			if ( dqtake( &pool->deques[ ( me + i ) % pool->nworkers ], t, 1 ) == 0 )
+			{
+				break;
+			}
+		}
+
+		if ( i == pool->nworkers )
+		{
+			return - 1;
+		}
+	}
+
+	mutex_lock( &pool->lock );
+
+	pool->nqueued -= 1;
+
+	mutex_unlock( &pool->lock );
+
+	return 0;
+}
+
+static void taskdone ( struct pool* pool )
+{
+	mutex_lock( &pool->lock );
+
+	pool->nunfinished -= 1;
+
+	if ( pool->nunfinished == 0 )
+	{
+		cond_broadcast( &pool->idle );
+	}
+
+	mutex_unlock( &pool->lock );
+}
+
+static void* poolworker ( void* arg )
+{
+	struct deque* dq;
+	struct pool*  pool;
+	struct task   t;
+
+	dq   = arg;
+	pool = dq->pool;
+
+	while ( 1 )
+	{
+		if ( pooltake( pool, dq->id, &t ) == 0 )
+		{
+			t.fn( t.arg );
+
+			taskdone( pool );
+
+			continue;
+		}
+
+		/* Nothing to do. A task counted in nqueued may be in the
+		   middle of being taken by another worker, in which case
+		   we just go around again.
+		*/
+		mutex_lock( &pool->lock );
+
+		while ( pool->nqueued == 0 && ! pool->stop )
+		{
+			cond_wait( &pool->work, &pool->lock );
+		}
+
+		if ( pool->nqueued == 0 && pool->stop )
+		{
+			mutex_unlock( &pool->lock );
+
+			break;
+		}
+
+		mutex_unlock( &pool->lock );
+	}
+
+	return 0;
+}
+
+/* Create a pool with 'nworkers' threads (0 for one per CPU).
+   Returns 0 on failure.
+*/
+struct pool* pool_create ( int nworkers )
+{
+	struct pool*  pool;
+	struct deque* dq;
+	int           i;
+
+	if ( nworkers <= 0 )
+	{
+		nworkers = thread_ncpu();
+	}
+
+	if ( nworkers > POOL_MAXWORKERS )
+	{
+		nworkers = POOL_MAXWORKERS;
+	}
+
+	pool = malloc( sizeof( struct pool ) );
+
+	if ( pool == 0 )
+	{
+		return 0;
+	}
+
+	memset( pool, 0, sizeof( struct pool ) );
+
+	mutex_init( &pool->lock );
+	cond_init( &pool->work );
+	cond_init( &pool->idle );
+
+	for ( i = 0; i < nworkers; i += 1 )
+	{
+		dq = &pool->deques[ i ];
+
+		mutex_init( &dq->lock );
+
+		dq->pool = pool;
+		dq->id   = i;
+	}
+
+	pool->nworkers = nworkers;
+
+	for ( i = 0; i < nworkers; i += 1 )
+	{
+		if ( thread_create( &pool->workers[ i ], poolworker, &pool->deques[ i ] ) < 0 )
+		{
+			pool->nworkers = i;
+
+			pool_destroy( pool );
+
+			return 0;
+		}
+	}
+
+	return pool;
+}
+
+/* Queue fn( arg ) to run on one of the pool's workers.
+   Runs it straight away if the deques are full.
+*/
+void pool_submit ( struct pool* pool, void ( *fn ) ( void* ), void* arg )
+{
+	struct task t;
+	int         me;
+	int         i;
+
+	t.fn  = fn;
+	t.arg = arg;
+
+	mutex_lock( &pool->lock );
+
+	pool->nunfinished += 1;
+
+	mutex_unlock( &pool->lock );
+
+	me = poolself( pool );
+
+	// From outside the pool, spread tasks across the workers
+	if ( me < 0 )
+	{
+		me = pool->next;
+
+		pool->next = ( pool->next + 1 ) % pool->nworkers;
+	}
+
+	for ( i = 0; i < pool->nworkers; i += 1 )
+	{
+		if ( dqpush( &pool->deques[ ( me + i ) % pool->nworkers ], &t ) == 0 )
+		{
+			break;
+		}
+	}
+
+	if ( i == pool->nworkers )
+	{
+		fn( arg );
+
+		taskdone( pool );
+
+		return;
+	}
+
+	mutex_lock( &pool->lock );
+
+	pool->nqueued += 1;
+
+	cond_signal( &pool->work );
+
+	mutex_unlock( &pool->lock );
+}
+
+/* Wait until every submitted task (and the tasks they submitted)
+   has run. Not to be called from a task.
+*/
+void pool_wait ( struct pool* pool )
+{
+	mutex_lock( &pool->lock );
+
+	while ( pool->nunfinished > 0 )
+	{
+		cond_wait( &pool->idle, &pool->lock );
+	}
+
+	mutex_unlock( &pool->lock );
+}
+
+// Finish the queued tasks, then stop the workers and free the pool
+void pool_destroy ( struct pool* pool )
+{
+	int i;
+
+	pool_wait( pool );
+
+	mutex_lock( &pool->lock );
+
+	pool->stop = 1;
+
+	cond_broadcast( &pool->work );
+
+	mutex_unlock( &pool->lock );
+
+	for ( i = 0; i < pool->nworkers; i += 1 )
+	{
+		thread_join( pool->workers[ i ], 0 );
+	}
+
+	free( pool );
+}
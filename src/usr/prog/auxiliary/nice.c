@@ -0,0 +1,42 @@
+// Run a command at a lower scheduling priority
+
+/* Ex.
+     $ nice /usr/bin/wisc/wisc_spinner
+     $ nice -n 3 /usr/bin/wisc/wisc_spinner
+   Unlike sh, nice does not search for the command, give its path.
+   The priority level is inherited across fork and exec.
+   Levels go from 0 (highest, the default) to NPRIO - 1.
+*/
+
+#include "kernel/types.h"
+#include "user.h"
+
+int main ( int argc, char* argv [] )
+{
+	int inc;
+	int i;
+
+	inc = 1;
+	i   = 1;
+
+	if ( argc > 2 && strcmp( argv[ 1 ], "-n" ) == 0 )
+	{
+		inc = atoi( argv[ 2 ] );
+		i   = 3;
+	}
+
+	if ( i >= argc )
+	{
+		printf( stderr, "Usage: nice [-n increment] command [args...]\n" );
+
+		exit();
+	}
+
+	nice( inc );
+
+	exec( argv[ i ], argv + i );
+
+	printf( stderr, "nice: exec %s failed\n", argv[ i ] );
+
+	exit();
+}
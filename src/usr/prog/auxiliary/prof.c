@@ -0,0 +1,205 @@
+// Run a command under the sampling profiler
+
+/* Ex.
+     $ prof /bin/wc README
+     $ prof -i 2 /usr/bin/wisc/wisc_spinner
+   Samples the whole system (all processes and the kernel) every
+   'interval' clock ticks (default 1) while the command runs. Unlike
+   sh, prof does not search for the command, give its path.
+
+   The samples are printed as text, to be picked out of the serial
+   console output on the host and symbolized with tools/profsym.py:
+
+     prof: proc <pid> <name>
+     prof: sample <cpu> <pid> <k|u> <eip> <caller> ... (hex)
+*/
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/rusage.h"
+#include "kernel/prof.h"
+#include "user.h"
+/* Needed to get the PROF constant in file.h, see init.c
+*/
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/date.h"
+#include "kernel/fs.h"
+#include "kernel/file.h"
+
+#define NBUF       64   // samples per read
+#define MAXPROCS   256
+#define MAXSEEN    256
+#define DRAINTICKS 5    // how often the buffers are emptied
+
+struct profsample samples [ NBUF ];
+struct procinfo   procs   [ MAXPROCS ];
+
+int  seen [ MAXSEEN ];  // pids whose name was printed
+int  nseen;
+int  nsamples;
+
+
+// Print the name of process 'pid', the first time it shows up.
+// Processes that are gone already stay nameless (their kernel samples still count)
+void printproc ( int pid, struct procinfo* procs, int nprocs )
+{
+	int i;
+
+	if ( pid == 0 )  // idle CPU
+	{
+		return;
+	}
+
+	for ( i = 0; i < nseen; i += 1 )
+	{
+		if ( seen[ i ] == pid )
+		{
+			return;
+		}
+	}
+
+	if ( nseen < MAXSEEN )
+	{
+		seen[ nseen ] = pid;
+
+		nseen += 1;
+	}
+
+	for ( i = 0; i < nprocs; i += 1 )
+	{
+		if ( procs[ i ].pid == pid )
+		{
+			printf( stdout, "prof: proc %d %s\n", pid, procs[ i ].name );
+
+			break;
+		}
+	}
+}
+
+// Print the samples collected so far
+void drain ( int fd, struct procinfo* procs, int nprocs )
+{
+	struct profsample* s;
+	int                n;
+	int                j;
+
+	while ( ( n = read( fd, samples, sizeof( samples ) ) ) > 0 )
+	{
+		for ( s = samples; s < samples + n / sizeof( struct profsample ); s += 1 )
+		{
+			printproc( s->pid, procs, nprocs );
+
+			printf( stdout, "prof: sample %d %d %c", s->cpu, s->pid, s->user ? 'u' : 'k' );
+
+			for ( j = 0; j < PROFDEPTH && s->pcs[ j ]; j += 1 )
+			{
+				printf( stdout, " %x", s->pcs[ j ] );
+			}
+
+			printf( stdout, "\n" );
+
+			nsamples += 1;
+		}
+	}
+}
+
+int main ( int argc, char* argv [] )
+{
+	int fd;
+	int interval;
+	int pid;
+	int nprocs;
+	int nlost;
+	int i;
+
+	interval = 1;
+	i        = 1;
+
+	if ( argc > 2 && strcmp( argv[ 1 ], "-i" ) == 0 )
+	{
+		interval = atoi( argv[ 2 ] );
+		i        = 3;
+	}
+
+	if ( i >= argc || interval < 1 )
+	{
+		printf( stderr, "Usage: prof [-i interval] command [args...]\n" );
+
+		exit();
+	}
+
+	if ( ( fd = open( "/dev/prof", O_RDONLY ) ) < 0 )
+	{
+		printf( stderr, "prof: cannot open /dev/prof\n" );
+
+		exit();
+	}
+
+	if ( ioctl( fd, PROF_IOCTL_START, interval ) < 0 )
+	{
+		printf( stderr, "prof: cannot start the profiler\n" );
+
+		exit();
+	}
+
+	pid = fork();
+
+	if ( pid < 0 )
+	{
+		printf( stderr, "prof: fork failed\n" );
+
+		ioctl( fd, PROF_IOCTL_STOP );
+
+		exit();
+	}
+
+	if ( pid == 0 )
+	{
+		close( fd );
+
+		exec( argv[ i ], argv + i );
+
+		printf( stderr, "prof: exec %s failed\n", argv[ i ] );
+
+		exit();
+	}
+
+	/* Empty the buffers every few ticks while the command runs.
+	   getprocs gives us the names of the processes sampled, and
+	   tells us when the command is done.
+	*/
+	while ( 1 )
+	{
+		sleep( DRAINTICKS );
+
+		nprocs = getprocs( procs, MAXPROCS );
+
+		drain( fd, procs, nprocs );
+
+		for ( i = 0; i < nprocs; i += 1 )
+		{
+			if ( procs[ i ].pid == pid )
+			{
+				break;
+			}
+		}
+
+		if ( i == nprocs || procs[ i ].state == 'Z' )
+		{
+			break;
+		}
+	}
+
+	nlost = ioctl( fd, PROF_IOCTL_STOP );
+
+	drain( fd, procs, nprocs );
+
+	wait();
+
+	close( fd );
+
+	printf( stdout, "prof: %d samples, %d lost\n", nsamples, nlost );
+
+	exit();
+}
@@ -0,0 +1,73 @@
+// List processes
+
+/* Ex.
+     $ ps
+     $ ps -l
+   Times are in clock ticks. With -l, also shows context switches
+   (voluntary/involuntary), page faults, and I/O (see rusage.h).
+*/
+
+#include "kernel/types.h"
+#include "kernel/rusage.h"
+#include "user.h"
+
+#define MAXPROCS  256
+
+struct procinfo procs [ MAXPROCS ];
+
+int main ( int argc, char* argv [] )
+{
+	struct procinfo* p;
+	int              n;
+	int              i;
+	int              lng;
+
+	lng = argc > 1 && strcmp( argv[ 1 ], "-l" ) == 0;
+
+	n = getprocs( procs, MAXPROCS );
+
+	if ( n < 0 )
+	{
+		printf( stderr, "ps: getprocs failed\n" );
+
+		exit();
+	}
+
+	if ( lng )
+	{
+		printf( stdout, "  PID  PPID S PRI CPU    MEM  UTIME  STIME   VCSW  IVCSW  FAULT  INBLK  OUBLK NAME\n" );
+	}
+	else
+	{
+		printf( stdout, "  PID  PPID S PRI CPU    MEM   TIME NAME\n" );
+	}
+
+	for ( i = 0; i < n; i += 1 )
+	{
+		p = &procs[ i ];
+
+		printf( stdout, "%5d %5d %c %3d %3d %5dK ",
+
+			p->pid, p->ppid, p->state, p->prio, p->cpu, p->sz / 1024
+		);
+
+		if ( lng )
+		{
+			printf( stdout, "%6d %6d %6d %6d %6d %6d %6d ",
+
+				p->ru.utime, p->ru.stime,
+				p->ru.nvcsw, p->ru.nivcsw,
+				p->ru.nfault,
+				p->ru.inblock, p->ru.oublock
+			);
+		}
+		else
+		{
+			printf( stdout, "%6d ", p->ru.utime + p->ru.stime );
+		}
+
+		printf( stdout, "%s\n", p->name );
+	}
+
+	exit();
+}
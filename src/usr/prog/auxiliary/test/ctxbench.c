@@ -0,0 +1,99 @@
+// Context switch microbenchmark
+
+/* Two processes bounce a byte back and forth over a pair of pipes.
+   Every round trip blocks each process once, so it costs (at least)
+   two context switches.
+
+   Run with an optional round trip count,
+     $ ctxbench 10000
+
+   Type ^P on the console afterwards to see the per-CPU switch and
+   %cr3 load counts.
+*/
+
+#include "kernel/types.h"
+#include "user.h"
+
+#define DEFAULT_NROUNDS 5000
+
+int main ( int argc, char* argv [] )
+{
+	int  ping [ 2 ];
+	int  pong [ 2 ];
+	int  nrounds;
+	int  i;
+	int  pid;
+	int  start,
+	     elapsed;
+	char c;
+
+	nrounds = DEFAULT_NROUNDS;
+
+	if ( argc > 1 )
+	{
+		nrounds = atoi( argv[ 1 ] );
+	}
+
+	if ( pipe( ping ) < 0 || pipe( pong ) < 0 )
+	{
+		printf( stderr, "ctxbench: pipe failed\n" );
+
+		exit();
+	}
+
+	pid = fork();
+
+	if ( pid < 0 )
+	{
+		printf( stderr, "ctxbench: fork failed\n" );
+
+		exit();
+	}
+
+	// Child echoes every byte back
+	if ( pid == 0 )
+	{
+		close( ping[ 1 ] );
+		close( pong[ 0 ] );
+
+		while ( read( ping[ 0 ], &c, 1 ) == 1 )
+		{
+			write( pong[ 1 ], &c, 1 );
+		}
+
+		exit();
+	}
+
+	close( ping[ 0 ] );
+	close( pong[ 1 ] );
+
+	c = 'x';
+
+	start = uptime();
+
+	for ( i = 0; i < nrounds; i += 1 )
+	{
+		if ( write( ping[ 1 ], &c, 1 ) != 1 || read( pong[ 0 ], &c, 1 ) != 1 )
+		{
+			printf( stderr, "ctxbench: round trip %d failed\n", i );
+
+			break;
+		}
+	}
+
+	elapsed = uptime() - start;
+
+	close( ping[ 1 ] );  // child sees EOF and exits
+	close( pong[ 0 ] );
+
+	wait();
+
+	printf( stdout, "ctxbench: %d round trips in %d ticks\n", i, elapsed );
+
+	if ( elapsed > 0 )
+	{
+		printf( stdout, "ctxbench: %d round trips per tick\n", i / elapsed );
+	}
+
+	exit();
+}
@@ -0,0 +1,197 @@
+// Test futexes and the mutex/condition variable library (ulock.c)
+
+#include "kernel/types.h"
+#include "user.h"
+#include "ulock.h"
+
+#define NTHREADS 4
+#define NITERS   2000
+#define NITEMS   100
+#define PGSIZE   4096
+
+char stacks [ NTHREADS ][ PGSIZE ] __attribute__ ( ( aligned ( PGSIZE ) ) );
+
+struct mutex lock = MUTEX_INITIALIZER;
+struct cond  nonempty = COND_INITIALIZER;
+
+volatile int counter;
+volatile int nitems;
+volatile int nconsumed;
+
+
+// futexwait returns straight away if the value doesn't match
+void wait_test ( void )
+{
+	int word;
+
+	printf( stdout, "futex wait test\n" );
+
+	word = 1;
+
+	if ( futexwait( &word, 0 ) != - 1 )
+	{
+		printf( stdout, "futex wait test: slept on a stale value\n" );
+		exit();
+	}
+
+	if ( futexwake( &word, 1 ) != 0 )
+	{
+		printf( stdout, "futex wait test: woke a waiter that doesn't exist\n" );
+		exit();
+	}
+
+	printf( stdout, "futex wait test: OK\n" );
+}
+
+// Threads increment a shared counter under a mutex
+void mutex_test ( void )
+{
+	int i;
+	int j;
+	int pid;
+
+	printf( stdout, "futex mutex test\n" );
+
+	counter = 0;
+
+	for ( i = 0; i < NTHREADS; i += 1 )
+	{
+		pid = clone( stacks[ i ] );
+
+		if ( pid < 0 )
+		{
+			printf( stdout, "futex mutex test: clone failed\n" );
+			exit();
+		}
+
+		if ( pid == 0 )
+		{
+			for ( j = 0; j < NITERS; j += 1 )
+			{
+				mutex_lock( &lock );
+
+				counter += 1;
+
+				// Now and then, block while holding the lock
+				if ( j % 256 == 0 )
+				{
+					sleep( 1 );
+				}
+
+				mutex_unlock( &lock );
+			}
+
+			exit();
+		}
+	}
+
+	while ( join( 0 ) > 0 )
+	{
+		;
+	}
+
+	if ( counter != NTHREADS * NITERS )
+	{
+		printf( stdout, "futex mutex test: counter is %d, expected %d\n", counter, NTHREADS * NITERS );
+		exit();
+	}
+
+	printf( stdout, "futex mutex test: OK\n" );
+}
+
+// Consumer threads wait on a condition variable for items
+void cond_test ( void )
+{
+	int i;
+	int pid;
+
+	printf( stdout, "futex cond test\n" );
+
+	nitems    = 0;
+	nconsumed = 0;
+
+	for ( i = 0; i < NTHREADS; i += 1 )
+	{
+		pid = clone( stacks[ i ] );
+
+		if ( pid < 0 )
+		{
+			printf( stdout, "futex cond test: clone failed\n" );
+			exit();
+		}
+
+		if ( pid == 0 )
+		{
+			mutex_lock( &lock );
+
+			while ( 1 )
+			{
+				while ( nitems == 0 && nconsumed < NITEMS )
+				{
+					cond_wait( &nonempty, &lock );
+				}
+
+				if ( nconsumed == NITEMS )
+				{
+					break;
+				}
+
+				nitems    -= 1;
+				nconsumed += 1;
+			}
+
+			mutex_unlock( &lock );
+
+			exit();
+		}
+	}
+
+	for ( i = 0; i < NITEMS; i += 1 )
+	{
+		mutex_lock( &lock );
+
+		nitems += 1;
+
+		cond_signal( &nonempty );
+
+		mutex_unlock( &lock );
+	}
+
+	// Wake the consumers that wait for an item that will never come
+	mutex_lock( &lock );
+
+	while ( nconsumed < NITEMS )
+	{
+		mutex_unlock( &lock );
+
+		sleep( 1 );
+
+		mutex_lock( &lock );
+	}
+
+	cond_broadcast( &nonempty );
+
+	mutex_unlock( &lock );
+
+	while ( join( 0 ) > 0 )
+	{
+		;
+	}
+
+	if ( nitems != 0 )
+	{
+		printf( stdout, "futex cond test: %d items left over\n", nitems );
+		exit();
+	}
+
+	printf( stdout, "futex cond test: OK\n" );
+}
+
+int main ( int argc, char* argv [] )
+{
+	wait_test();
+	mutex_test();
+	cond_test();
+
+	exit();
+}
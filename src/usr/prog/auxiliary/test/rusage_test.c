@@ -0,0 +1,166 @@
+// Test resource usage accounting (getrusage, getprocs)
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/rusage.h"
+#include "user.h"
+
+#define MAXPROCS 64
+
+struct procinfo procs [ MAXPROCS ];
+
+volatile int sink;
+
+
+// Spin until at least one clock tick was charged to us
+void spin ( void )
+{
+	struct rusage ru;
+	int           i;
+
+	do
+	{
+		for ( i = 0; i < 100000; i += 1 )
+		{
+			sink += i;
+		}
+
+		getrusage( RUSAGE_SELF, &ru );
+	}
+	while ( ru.utime + ru.stime == 0 );
+}
+
+// CPU time and I/O are charged to the process
+void self_test ( void )
+{
+	struct rusage before;
+	struct rusage after;
+	char          buf [ 64 ];
+	int           fd;
+
+	printf( stdout, "rusage self test\n" );
+
+	getrusage( RUSAGE_SELF, &before );
+
+	spin();
+
+	fd = open( "README", O_RDONLY );
+
+	if ( fd < 0 )
+	{
+		printf( stdout, "rusage self test: open README failed\n" );
+		exit();
+	}
+
+	read( fd, buf, sizeof( buf ) );
+
+	close( fd );
+
+	sleep( 1 );
+
+	getrusage( RUSAGE_SELF, &after );
+
+	if ( after.utime + after.stime == 0 )
+	{
+		printf( stdout, "rusage self test: no CPU time\n" );
+		exit();
+	}
+
+	if ( after.rchar < before.rchar + sizeof( buf ) )
+	{
+		printf( stdout, "rusage self test: read not counted\n" );
+		exit();
+	}
+
+	if ( after.nvcsw == before.nvcsw )
+	{
+		printf( stdout, "rusage self test: sleep not counted as a context switch\n" );
+		exit();
+	}
+
+	if ( getrusage( 12345, &after ) != - 1 )
+	{
+		printf( stdout, "rusage self test: bad 'who' accepted\n" );
+		exit();
+	}
+
+	printf( stdout, "rusage self test: OK\n" );
+}
+
+// A waited for child's time goes to RUSAGE_CHILDREN
+void children_test ( void )
+{
+	struct rusage ru;
+	int           pid;
+
+	printf( stdout, "rusage children test\n" );
+
+	pid = fork();
+
+	if ( pid == 0 )
+	{
+		spin();
+
+		exit();
+	}
+
+	wait();
+
+	getrusage( RUSAGE_CHILDREN, &ru );
+
+	if ( ru.utime + ru.stime == 0 )
+	{
+		printf( stdout, "rusage children test: child's time not counted\n" );
+		exit();
+	}
+
+	printf( stdout, "rusage children test: OK\n" );
+}
+
+// We show up in getprocs
+void getprocs_test ( void )
+{
+	int n;
+	int i;
+
+	printf( stdout, "getprocs test\n" );
+
+	n = getprocs( procs, MAXPROCS );
+
+	for ( i = 0; i < n; i += 1 )
+	{
+		if ( procs[ i ].pid == getpid() )
+		{
+			break;
+		}
+	}
+
+	if ( i == n )
+	{
+		printf( stdout, "getprocs test: not listed\n" );
+		exit();
+	}
+
+	if ( procs[ i ].state != 'R' || strcmp( procs[ i ].name, "rusage_test" ) != 0 )
+	{
+		printf( stdout, "getprocs test: wrong state or name\n" );
+		exit();
+	}
+
+	if ( getprocs( procs, 0 ) != 0 )
+	{
+		printf( stdout, "getprocs test: filled an empty buffer\n" );
+		exit();
+	}
+
+	printf( stdout, "getprocs test: OK\n" );
+}
+
+int main ( int argc, char* argv [] )
+{
+	self_test();
+	children_test();
+	getprocs_test();
+
+	exit();
+}
@@ -0,0 +1,175 @@
+// Test shared memory segments (shmget, shmat, shmdt)
+
+#include "kernel/types.h"
+#include "user.h"
+
+#define KEY  42
+#define SIZE 8192
+
+void sharing_test ( void )
+{
+	int   id;
+	int   pid;
+	char* mem;
+
+	printf( stdout, "shm sharing test\n" );
+
+	id = shmget( KEY, SIZE );
+
+	if ( id < 0 )
+	{
+		printf( stdout, "shm sharing test: shmget failed\n" );
+		exit();
+	}
+
+	mem = shmat( id );
+
+	if ( mem == ( char* ) - 1 )
+	{
+		printf( stdout, "shm sharing test: shmat failed\n" );
+		exit();
+	}
+
+	mem[ 0 ]        = 'p';
+	mem[ SIZE - 1 ] = 0;
+
+	pid = fork();
+
+	if ( pid < 0 )
+	{
+		printf( stdout, "shm sharing test: fork failed\n" );
+		exit();
+	}
+
+	// Child inherits the attachment, and writes to it
+	if ( pid == 0 )
+	{
+		if ( mem[ 0 ] != 'p' )
+		{
+			printf( stdout, "shm sharing test: child does not see parent's write\n" );
+			exit();
+		}
+
+		mem[ 0 ]        = 'c';
+		mem[ SIZE - 1 ] = 'c';
+
+		exit();
+	}
+
+	wait();
+
+	if ( mem[ 0 ] != 'c' || mem[ SIZE - 1 ] != 'c' )
+	{
+		printf( stdout, "shm sharing test: parent does not see child's write\n" );
+		exit();
+	}
+
+	// Lookup by key returns the same segment
+	if ( shmget( KEY, SIZE ) != id || shmat( id ) != mem )
+	{
+		printf( stdout, "shm sharing test: lookup by key failed\n" );
+		exit();
+	}
+
+	if ( shmdt( mem ) < 0 )
+	{
+		printf( stdout, "shm sharing test: shmdt failed\n" );
+		exit();
+	}
+
+	if ( shmdt( mem ) == 0 )
+	{
+		printf( stdout, "shm sharing test: double shmdt succeeded\n" );
+		exit();
+	}
+
+	printf( stdout, "shm sharing test: OK\n" );
+}
+
+// System calls accept pointers into shared memory
+void syscall_test ( void )
+{
+	int   id;
+	int   fds [ 2 ];
+	char* mem;
+	char  buf [ 6 ];
+
+	printf( stdout, "shm syscall test\n" );
+
+	id  = shmget( 0, 4096 );
+	mem = shmat( id );
+
+	if ( id < 0 || mem == ( char* ) - 1 )
+	{
+		printf( stdout, "shm syscall test: shmget/shmat failed\n" );
+		exit();
+	}
+
+	strcpy( mem, "hello" );
+
+	if ( pipe( fds ) < 0 )
+	{
+		printf( stdout, "shm syscall test: pipe failed\n" );
+		exit();
+	}
+
+	if ( write( fds[ 1 ], mem, 6 ) != 6 )
+	{
+		printf( stdout, "shm syscall test: write from segment failed\n" );
+		exit();
+	}
+
+	if ( read( fds[ 0 ], buf, 6 ) != 6 || strcmp( buf, "hello" ) != 0 )
+	{
+		printf( stdout, "shm syscall test: read back failed\n" );
+		exit();
+	}
+
+	close( fds[ 0 ] );
+	close( fds[ 1 ] );
+
+	shmdt( mem );
+
+	printf( stdout, "shm syscall test: OK\n" );
+}
+
+// Segments that are never attached go away when their creator exits
+void unattached_test ( void )
+{
+	int i;
+	int id;
+
+	printf( stdout, "shm unattached test\n" );
+
+	// More than fit in the table at once
+	for ( i = 0; i < 40; i += 1 )
+	{
+		if ( fork() == 0 )
+		{
+			shmget( 0, 4096 );
+
+			exit();
+		}
+
+		wait();
+	}
+
+	id = shmget( 0, 4096 );
+
+	if ( id < 0 )
+	{
+		printf( stdout, "shm unattached test: segments leaked\n" );
+		exit();
+	}
+
+	printf( stdout, "shm unattached test: OK\n" );
+}
+
+int main ( int argc, char* argv [] )
+{
+	sharing_test();
+	syscall_test();
+	unattached_test();
+
+	exit();
+}
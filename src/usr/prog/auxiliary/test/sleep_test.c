@@ -0,0 +1,107 @@
+// Test sleep (kernel timer wheel)
+
+/* Several children sleep for different lengths of time at once,
+   some long enough to go through the wheel's second level (see
+   kernel/timer.c). Each checks that it slept at least as long as
+   it asked for, and not much longer.
+
+   exit doesn't take a status, so each child reports back through
+   a pipe: 'y' if its check passed, 'n' if not. A child that
+   doesn't report at all (crashed) counts as a failure too.
+*/
+
+#include "kernel/types.h"
+#include "user.h"
+
+#define SLACK 5  // ticks
+
+int durations [] = { 1, 3, 10, 63, 64, 65, 130, 200 };
+
+#define NDURATIONS ( sizeof( durations ) / sizeof( durations[ 0 ] ) )
+
+int main ( int argc, char* argv [] )
+{
+	int  i;
+	int  pid;
+	int  start,
+	     elapsed;
+	int  fds [ 2 ];
+	int  npassed;
+	char c;
+
+	printf( stdout, "sleep test\n" );
+
+	if ( pipe( fds ) < 0 )
+	{
+		printf( stdout, "sleep test: pipe failed\n" );
+		exit();
+	}
+
+	for ( i = 0; i < NDURATIONS; i += 1 )
+	{
+		pid = fork();
+
+		if ( pid < 0 )
+		{
+			printf( stdout, "sleep test: fork failed\n" );
+			exit();
+		}
+
+		if ( pid == 0 )
+		{
+			close( fds[ 0 ] );
+
+			c = 'y';
+
+			start = uptime();
+
+			sleep( durations[ i ] );
+
+			elapsed = uptime() - start;
+
+			if ( elapsed < durations[ i ] || elapsed > durations[ i ] + SLACK )
+			{
+				printf( stdout, "sleep test: asked for %d ticks, slept %d\n",
+
+					durations[ i ], elapsed
+				);
+
+				c = 'n';
+			}
+
+			write( fds[ 1 ], &c, 1 );
+
+			exit();
+		}
+	}
+
+	close( fds[ 1 ] );
+
+	for ( i = 0; i < NDURATIONS; i += 1 )
+	{
+		wait();
+	}
+
+	// All children are gone, so this reads up to end of file
+	npassed = 0;
+
+	while ( read( fds[ 0 ], &c, 1 ) == 1 )
+	{
+		if ( c == 'y' )
+		{
+			npassed += 1;
+		}
+	}
+
+	close( fds[ 0 ] );
+
+	if ( npassed != NDURATIONS )
+	{
+		printf( stdout, "sleep test: %d of %d checks failed\n", NDURATIONS - npassed, NDURATIONS );
+		exit();
+	}
+
+	printf( stdout, "sleep test: OK\n" );
+
+	exit();
+}
@@ -0,0 +1,125 @@
+// Test threads (clone, join)
+
+#include "kernel/types.h"
+#include "user.h"
+
+#define NTHREADS 4
+#define PGSIZE   4096
+
+int  slots [ NTHREADS ];
+char stacks [ NTHREADS ][ PGSIZE ] __attribute__ ( ( aligned ( PGSIZE ) ) );
+
+// Each thread writes its own slot in shared memory, and grows the heap
+void sharing_test ( void )
+{
+	int   i;
+	int   pid;
+	int   njoined;
+	void* stack;
+	char* heap;
+
+	printf( stdout, "thread sharing test\n" );
+
+	for ( i = 0; i < NTHREADS; i += 1 )
+	{
+		pid = clone( stacks[ i ] );
+
+		if ( pid < 0 )
+		{
+			printf( stdout, "thread sharing test: clone failed\n" );
+			exit();
+		}
+
+		// Thread, 'i' comes from the copy of our stack
+		if ( pid == 0 )
+		{
+			heap = sbrk( PGSIZE );
+
+			if ( heap != ( char* ) - 1 )
+			{
+				heap[ 0 ] = i;  // fault if the heap isn't shared...
+			}
+
+			slots[ i ] = i + 1;
+
+			exit();
+		}
+	}
+
+	// Threads are not children for wait
+	if ( wait() != - 1 )
+	{
+		printf( stdout, "thread sharing test: wait reaped a thread\n" );
+		exit();
+	}
+
+	for ( njoined = 0; ( pid = join( &stack ) ) > 0; njoined += 1 )
+	{
+		if ( ( char* ) stack < stacks[ 0 ] || ( char* ) stack > stacks[ NTHREADS - 1 ] )
+		{
+			printf( stdout, "thread sharing test: join returned a bad stack\n" );
+			exit();
+		}
+	}
+
+	if ( njoined != NTHREADS )
+	{
+		printf( stdout, "thread sharing test: joined %d threads\n", njoined );
+		exit();
+	}
+
+	for ( i = 0; i < NTHREADS; i += 1 )
+	{
+		if ( slots[ i ] != i + 1 )
+		{
+			printf( stdout, "thread sharing test: slot %d not written\n", i );
+			exit();
+		}
+	}
+
+	printf( stdout, "thread sharing test: OK\n" );
+}
+
+// Open files are shared, a file closed by a thread is closed for all
+void files_test ( void )
+{
+	int fds [ 2 ];
+	int pid;
+
+	printf( stdout, "thread files test\n" );
+
+	if ( pipe( fds ) < 0 )
+	{
+		printf( stdout, "thread files test: pipe failed\n" );
+		exit();
+	}
+
+	pid = clone( stacks[ 0 ] );
+
+	if ( pid == 0 )
+	{
+		close( fds[ 1 ] );
+
+		exit();
+	}
+
+	join( 0 );
+
+	if ( write( fds[ 1 ], "x", 1 ) != - 1 )
+	{
+		printf( stdout, "thread files test: fd still open\n" );
+		exit();
+	}
+
+	close( fds[ 0 ] );
+
+	printf( stdout, "thread files test: OK\n" );
+}
+
+int main ( int argc, char* argv [] )
+{
+	sharing_test();
+	files_test();
+
+	exit();
+}
@@ -0,0 +1,141 @@
+// Test the thread library and task pool (uthread.c)
+
+#include "kernel/types.h"
+#include "user.h"
+#include "ulock.h"
+#include "uthread.h"
+
+#define NTHREADS 4
+#define NMALLOCS 200
+#define NLEAVES  256
+
+struct mutex lock = MUTEX_INITIALIZER;
+
+volatile int nleaves;
+
+
+// Each thread mallocs and frees, checking nobody else got its blocks
+void* mallocer ( void* arg )
+{
+	char* p [ 8 ];
+	int   i;
+	int   j;
+
+	for ( i = 0; i < NMALLOCS; i += 1 )
+	{
+		for ( j = 0; j < 8; j += 1 )
+		{
+			p[ j ] = malloc( 16 + j * 8 );
+
+			if ( p[ j ] == 0 )
+			{
+				return ( void* ) - 1;
+			}
+
+			memset( p[ j ], ( int ) arg, 16 + j * 8 );
+		}
+
+		for ( j = 0; j < 8; j += 1 )
+		{
+			if ( p[ j ][ 0 ] != ( char ) ( int ) arg || p[ j ][ 15 + j * 8 ] != ( char ) ( int ) arg )
+			{
+				return ( void* ) - 1;
+			}
+
+			free( p[ j ] );
+		}
+	}
+
+	return arg;
+}
+
+void thread_test ( void )
+{
+	struct uthread* threads [ NTHREADS ];
+	void*           ret;
+	int             i;
+
+	printf( stdout, "uthread thread test\n" );
+
+	for ( i = 0; i < NTHREADS; i += 1 )
+	{
+		if ( thread_create( &threads[ i ], mallocer, ( void* ) ( i + 1 ) ) < 0 )
+		{
+			printf( stdout, "uthread thread test: thread_create failed\n" );
+			exit();
+		}
+	}
+
+	// Join out of creation order
+	for ( i = NTHREADS - 1; i >= 0; i -= 1 )
+	{
+		if ( thread_join( threads[ i ], &ret ) < 0 || ret != ( void* ) ( i + 1 ) )
+		{
+			printf( stdout, "uthread thread test: thread %d failed\n", i );
+			exit();
+		}
+	}
+
+	printf( stdout, "uthread thread test: OK\n" );
+}
+
+struct pool* pool;
+
+// Task that splits itself in two until it is down to one leaf
+void split ( void* arg )
+{
+	int n;
+
+	n = ( int ) arg;
+
+	if ( n == 1 )
+	{
+		mutex_lock( &lock );
+
+		nleaves += 1;
+
+		mutex_unlock( &lock );
+
+		return;
+	}
+
+	pool_submit( pool, split, ( void* ) ( n / 2 ) );
+	pool_submit( pool, split, ( void* ) ( n - n / 2 ) );
+}
+
+void pool_test ( void )
+{
+	printf( stdout, "uthread pool test\n" );
+
+	pool = pool_create( 0 );
+
+	if ( pool == 0 )
+	{
+		printf( stdout, "uthread pool test: pool_create failed\n" );
+		exit();
+	}
+
+	nleaves = 0;
+
+	pool_submit( pool, split, ( void* ) NLEAVES );
+
+	pool_wait( pool );
+
+	if ( nleaves != NLEAVES )
+	{
+		printf( stdout, "uthread pool test: %d leaves, expected %d\n", nleaves, NLEAVES );
+		exit();
+	}
+
+	pool_destroy( pool );
+
+	printf( stdout, "uthread pool test: OK\n" );
+}
+
+int main ( int argc, char* argv [] )
+{
+	thread_test();
+	pool_test();
+
+	exit();
+}
@@ -0,0 +1,145 @@
+// Show the processes using the most CPU
+
+/* Ex.
+     $ top
+     $ top -d 50 -n 5
+   Every 'delay' clock ticks (default 100), prints the processes that
+   used the CPU since the last round, busiest first. Stops after
+   'n' rounds (default, never).
+   %CPU is the share of one CPU's time.
+*/
+
+#include "kernel/types.h"
+#include "kernel/rusage.h"
+#include "user.h"
+#include "uthread.h"
+
+#define MAXPROCS  256
+#define MAXLINES  20
+
+struct procinfo bufs [ 2 ][ MAXPROCS ];
+
+uint used  [ MAXPROCS ];  // ticks used by cur[ i ] this round
+int  order [ MAXPROCS ];  // cur sorted by used, descending
+
+// Ticks used by the process with pid 'pid' according to prev, 0 if it's not there
+uint prevtime ( struct procinfo* prev, int nprev, int pid )
+{
+	int i;
+
+	// Both lists are in pid order, but a linear search is plenty
+	for ( i = 0; i < nprev; i += 1 )
+	{
+		if ( prev[ i ].pid == pid )
+		{
+			return prev[ i ].ru.utime + prev[ i ].ru.stime;
+		}
+	}
+
+	return 0;
+}
+
+int main ( int argc, char* argv [] )
+{
+	struct procinfo* cur;
+	struct procinfo* prev;
+	struct procinfo* p;
+	int              ncur,
+	                 nprev;
+	int              delay,
+	                 rounds;
+	int              ncpu;
+	uint             now,
+	                 then,
+	                 elapsed,
+	                 total;
+	int              i, j, k;
+
+	delay  = 100;
+	rounds = 0;
+
+	for ( i = 1; i + 1 < argc; i += 2 )
+	{
+		if ( strcmp( argv[ i ], "-d" ) == 0 )
+		{
+			delay = atoi( argv[ i + 1 ] );
+		}
+		else if ( strcmp( argv[ i ], "-n" ) == 0 )
+		{
+			rounds = atoi( argv[ i + 1 ] );
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if ( i < argc || delay <= 0 )
+	{
+		printf( stderr, "Usage: top [-d ticks] [-n rounds]\n" );
+
+		exit();
+	}
+
+	ncpu = thread_ncpu();
+
+	prev  = bufs[ 0 ];
+	nprev = getprocs( prev, MAXPROCS );
+	then  = uptime();
+
+	for ( k = 0; rounds == 0 || k < rounds; k += 1 )
+	{
+		sleep( delay );
+
+		cur  = bufs[ ( k + 1 ) % 2 ];
+		ncur = getprocs( cur, MAXPROCS );
+		now  = uptime();
+
+		elapsed = now - then > 0 ? now - then : 1;
+		total   = 0;
+
+		// Insertion sort by ticks used this round
+		for ( i = 0; i < ncur; i += 1 )
+		{
+			p = &cur[ i ];
+
+			used[ i ] = p->ru.utime + p->ru.stime - prevtime( prev, nprev, p->pid );
+
+			total += used[ i ];
+
+			for ( j = i; j > 0 && used[ order[ j - 1 ] ] < used[ i ]; j -= 1 )
+			{
+				order[ j ] = order[ j - 1 ];
+			}
+
+			order[ j ] = i;
+		}
+
+		printf( stdout, "\ntop - up %d ticks, %d processes, %d cpus, %d%% busy\n\n",
+
+			now, ncur, ncpu, total * 100 / ( elapsed * ncpu )
+		);
+
+		printf( stdout, "  PID S PRI CPU %%CPU   TIME  FAULT NAME\n" );
+
+		for ( i = 0; i < ncur && i < MAXLINES; i += 1 )
+		{
+			p = &cur[ order[ i ] ];
+
+			printf( stdout, "%5d %c %3d %3d %4d %6d %6d %s\n",
+
+				p->pid, p->state, p->prio, p->cpu,
+				used[ order[ i ] ] * 100 / elapsed,
+				p->ru.utime + p->ru.stime,
+				p->ru.nfault,
+				p->name
+			);
+		}
+
+		prev  = cur;
+		nprev = ncur;
+		then  = now;
+	}
+
+	exit();
+}
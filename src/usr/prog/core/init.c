@@ -41,6 +41,12 @@ int main ( void )
 		mknod( "/dev/display", DISPLAY, 0 );
 	}
 
+	// And the profiler (see prof)
+	if ( open( "/dev/prof", O_RDONLY ) < 0 )
+	{
+		mknod( "/dev/prof", PROF, 0 );
+	}
+
 
 	/* Loops:
 		- starts a shell in child process
@@ -1,17 +1,31 @@
 /* Word count */
 
+/* With more than one file, the files are counted in parallel by
+   a task pool (see uthread.c), one task per file. Results are
+   printed in argument order once all are done.
+*/
+
 #include "kernel/types.h"
 #include "kernel/fcntl.h"
 #include "user.h"
+#include "uthread.h"
 
-char buf [ 512 ];
-
-void wc ( int fd, char* name )
+struct wcfile
 {
-	int i, n;
-	int l, w, c, inword;
+	char* name;
+	int   l, w, c;
+	int   err;       // 0, or message to print instead of the counts
+	char* errmsg;
+};
+
+// Count lines, words and bytes read from fd. Returns -1 on read error
+int count ( int fd, struct wcfile* f )
+{
+	char buf [ 512 ];  // on the stack, one per task
+	int  i, n;
+	int  inword;
 
-	l = w = c = 0;
+	f->l = f->w = f->c = 0;
 	inword = 0;
 
 	while ( 1 )
@@ -26,12 +40,12 @@ void wc ( int fd, char* name )
 		for ( i = 0; i < n; i += 1 )
 		{
 			// Count bytes
-			c += 1;
+			f->c += 1;
 
 			// Count newlines
 			if ( buf[ i ] == '\n' )
 			{
-				l += 1;
+				f->l += 1;
 			}
 
 			// Count words
@@ -43,50 +57,135 @@ void wc ( int fd, char* name )
 			{
 				inword = 1;
 
-				w += 1;
+				f->w += 1;
 			}
 		}
 	}
 
-	if ( n < 0 )
+	return n < 0 ? - 1 : 0;
+}
+
+void print ( struct wcfile* f )
+{
+	if ( f->err )
 	{
-		printf( stderr, "wc: read error\n" );
+		printf( stderr, f->errmsg, f->name );
 
-		exit();
+		return;
 	}
 
 	// printf( stdout, "%d %d %d %s\n", l, w, c, name );
-	printf( stdout, "file  : %s\n", name );
-	printf( stdout, "lines : %d\n", l );
-	printf( stdout, "words : %d\n", w );
-	printf( stdout, "bytes : %d\n", c );
+	printf( stdout, "file  : %s\n", f->name );
+	printf( stdout, "lines : %d\n", f->l );
+	printf( stdout, "words : %d\n", f->w );
+	printf( stdout, "bytes : %d\n", f->c );
+}
+
+// Task, count one file
+void wcfile ( void* arg )
+{
+	struct wcfile* f;
+	int            fd;
+
+	f = arg;
+
+	if ( ( fd = open( f->name, O_RDONLY ) ) < 0 )
+	{
+		f->err    = 1;
+		f->errmsg = "wc: cannot open %s\n";
+
+		return;
+	}
+
+	if ( count( fd, f ) < 0 )
+	{
+		f->err    = 1;
+		f->errmsg = "wc: read error %s\n";
+	}
+
+	close( fd );
 }
 
 int main ( int argc, char* argv [] )
 {
-	int fd, i;
+	struct wcfile* files;
+	struct wcfile  f;
+	struct pool*   pool;
+	int            nfiles;
+	int            i;
 
 	// Use stdin as input
 	if ( argc <= 1 )
 	{
-		wc( stdin, "" );
+		f.name = "";
+		f.err  = 0;
+
+		if ( count( stdin, &f ) < 0 )
+		{
+			printf( stderr, "wc: read error\n" );
+
+			exit();
+		}
+
+		print( &f );
+
+		exit();
+	}
+
+	nfiles = argc - 1;
+
+	files = malloc( nfiles * sizeof( struct wcfile ) );
+
+	if ( files == 0 )
+	{
+		printf( stderr, "wc: out of memory\n" );
 
 		exit();
 	}
 
-	for ( i = 1; i < argc; i += 1 )
+	for ( i = 0; i < nfiles; i += 1 )
 	{
-		if ( ( fd = open( argv[ i ], O_RDONLY ) ) < 0 )
-		{
-			printf( stderr, "wc: cannot open %s\n", argv[ i ] );
+		files[ i ].name = argv[ i + 1 ];
+		files[ i ].err  = 0;
+	}
 
-			exit();
+	// No point in threads for a single file
+	pool = 0;
+
+	if ( nfiles > 1 )
+	{
+		pool = pool_create( nfiles < thread_ncpu() ? nfiles : thread_ncpu() );
+	}
+
+	for ( i = 0; i < nfiles; i += 1 )
+	{
+		if ( pool != 0 )
+		{
+			pool_submit( pool, wcfile, &files[ i ] );
+		}
+		else
+		{
+			wcfile( &files[ i ] );
 		}
+	}
 
-		wc( fd, argv[ i ] );
+	if ( pool != 0 )
+	{
+		pool_destroy( pool );
+	}
 
-		close( fd );
+	for ( i = 0; i < nfiles; i += 1 )
+	{
+		print( &files[ i ] );
+
+		// As before, stop at the first file that failed
+		if ( files[ i ].err )
+		{
+			break;
+		}
 	}
 
+	free( files );
+
 	exit();
 }
@@ -0,0 +1,185 @@
+# Symbolize the samples printed by the 'prof' user program
+#
+# Ex.
+#   make qemu-nox | tee qemu.log
+#   ...
+#   $ prof /bin/wc README
+#   ...
+#   python3 tools/profsym.py qemu.log
+#   python3 tools/profsym.py --folded qemu.log > out.folded   # for flamegraph.pl
+#
+# Kernel addresses are looked up in img/kernel, user addresses in the
+# program (by process name) under fs/. Uses 'nm' from binutils.
+
+import argparse
+import bisect
+import os
+import re
+import subprocess
+import sys
+
+
+class Symbols:
+
+	def __init__ ( self, path ):
+
+		self.addrs = []
+		self.names = []
+
+		out = subprocess.run(
+
+			[ "nm", "-n", "--defined-only", path ],
+			capture_output = True, text = True, check = True
+
+		).stdout
+
+		for line in out.splitlines():
+
+			fields = line.split()
+
+			# Functions only
+			if len( fields ) == 3 and fields[ 1 ] in "TtWw":
+
+				self.addrs.append( int( fields[ 0 ], 16 ) )
+				self.names.append( fields[ 2 ] )
+
+	def lookup ( self, addr ):
+
+		i = bisect.bisect_right( self.addrs, addr ) - 1
+
+		if i < 0:
+
+			return "0x{:x}".format( addr )
+
+		return self.names[ i ]
+
+
+def findprogram ( userdirs, name ):
+
+	for userdir in userdirs:
+
+		for dirpath, dirnames, filenames in os.walk( userdir ):
+
+			if name in filenames:
+
+				return os.path.join( dirpath, name )
+
+	return None
+
+
+def main ():
+
+	parser = argparse.ArgumentParser( description = "Symbolize xv6 profiler samples" )
+
+	parser.add_argument( "log",                                            help = "console output containing 'prof:' lines" )
+	parser.add_argument( "--kernel",  default = "img/kernel",              help = "kernel ELF (default img/kernel)" )
+	parser.add_argument( "--userdir", default = [ "fs" ], action = "append", help = "where to find user program ELFs (default fs/)" )
+	parser.add_argument( "--folded",  action = "store_true",               help = "print folded stacks, for flamegraph.pl" )
+	parser.add_argument( "--top",     type = int, default = 30,             help = "number of functions to list (default 30)" )
+
+	args = parser.parse_args()
+
+	kernel   = Symbols( args.kernel )
+	programs = {}  # name -> Symbols, or None if not found
+	names    = {}  # pid -> name
+
+	self     = {}  # function -> samples where it was running
+	total    = {}  # function -> samples where it was on the stack
+	folded   = {}  # stack -> samples
+	nsamples = 0
+
+	# Console output may be interleaved with other text, pick out our lines
+	procre   = re.compile( r"prof: proc (\d+) (\S+)" )
+	samplere = re.compile( r"prof: sample (\d+) (\d+) ([ku])((?: [0-9a-f]+)+)" )
+
+	with open( args.log, errors = "replace" ) as f:
+
+		for line in f:
+
+			m = procre.search( line )
+
+			if m:
+
+				names[ int( m.group( 1 ) ) ] = m.group( 2 )
+
+				continue
+
+			m = samplere.search( line )
+
+			if not m:
+
+				continue
+
+			pid  = int( m.group( 2 ) )
+			user = m.group( 3 ) == "u"
+			pcs  = [ int( pc, 16 ) for pc in m.group( 4 ).split() ]
+			name = names.get( pid, "pid{}".format( pid ) if pid else "idle" )
+
+			if user:
+
+				if name not in programs:
+
+					path = findprogram( args.userdir, name )
+
+					programs[ name ] = Symbols( path ) if path else None
+
+				syms = programs[ name ]
+
+			else:
+
+				syms = kernel
+
+			# pcs[ 0 ] is where we were, the others are return
+			# addresses, so back up into the call instruction
+			stack = []
+
+			for i, pc in enumerate( pcs ):
+
+				if i > 0:
+
+					pc -= 1
+
+				func = syms.lookup( pc ) if syms else "0x{:x}".format( pc )
+
+				stack.append( func if not user else "{}`{}".format( name, func ) )
+
+			nsamples += 1
+
+			self[ stack[ 0 ] ] = self.get( stack[ 0 ], 0 ) + 1
+
+			for func in set( stack ):
+
+				total[ func ] = total.get( func, 0 ) + 1
+
+			key = ";".join( [ name if user else "kernel" ] + stack[ :: - 1 ] )
+
+			folded[ key ] = folded.get( key, 0 ) + 1
+
+	if nsamples == 0:
+
+		sys.exit( "profsym: no samples in {}".format( args.log ) )
+
+	if args.folded:
+
+		for key, n in sorted( folded.items() ):
+
+			print( key, n )
+
+		return
+
+	print( "{} samples\n".format( nsamples ) )
+	print( "{:>7} {:>7}  {}".format( "self%", "total%", "function" ) )
+
+	for func, n in sorted( self.items(), key = lambda item: - item[ 1 ] )[ : args.top ]:
+
+		print( "{:7.1f} {:7.1f}  {}".format(
+
+			100.0 * n / nsamples,
+			100.0 * total[ func ] / nsamples,
+			func
+		) )
+
+
+if __name__ == "__main__":
+
+	main()